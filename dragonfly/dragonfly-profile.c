@@ -0,0 +1,86 @@
+#include "dragonfly-profile.h"
+
+enum
+{
+  PROFILE_FORWARD,
+  PROFILE_FORWARD_CYCLES,
+  PROFILE_REVERSE,
+  PROFILE_REVERSE_CYCLES,
+  PROFILE_COMMIT,
+  PROFILE_FIELDS
+};
+
+/* counters of this PE, doubles so that they all go in one reduction */
+static double profile[ PROFILE_CLASSES ][ PROFILE_TYPES ][ PROFILE_FIELDS ];
+
+static const char * class_names[ PROFILE_CLASSES ] = { "terminal", "router", "mpi" };
+
+void
+dragonfly_profile_forward( int lp_class,
+			   int type,
+			   tw_clock cycles )
+{
+    profile[ lp_class ][ type ][ PROFILE_FORWARD ]++;
+    profile[ lp_class ][ type ][ PROFILE_FORWARD_CYCLES ] += cycles;
+}
+
+void
+dragonfly_profile_reverse( int lp_class,
+			   int type,
+			   tw_clock cycles )
+{
+    profile[ lp_class ][ type ][ PROFILE_REVERSE ]++;
+    profile[ lp_class ][ type ][ PROFILE_REVERSE_CYCLES ] += cycles;
+}
+
+void
+dragonfly_profile_commit( int lp_class,
+			  int type )
+{
+    profile[ lp_class ][ type ][ PROFILE_COMMIT ]++;
+}
+
+void
+dragonfly_profile_report( const char * const * type_names,
+			  int n_types )
+{
+    static double total[ PROFILE_CLASSES ][ PROFILE_TYPES ][ PROFILE_FIELDS ];
+    double all_cycles = 0;
+    int c, t;
+
+    MPI_Reduce( profile, total, PROFILE_CLASSES * PROFILE_TYPES * PROFILE_FIELDS,
+		MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD );
+
+    if( !tw_ismaster() )
+       return;
+
+    for( c = 0; c < PROFILE_CLASSES; c++ )
+      for( t = 0; t < PROFILE_TYPES; t++ )
+	 all_cycles += total[ c ][ t ][ PROFILE_FORWARD_CYCLES ] + total[ c ][ t ][ PROFILE_REVERSE_CYCLES ];
+
+    printf( "\nDragonfly handler profile (cycles per call, share of all handler cycles)\n" );
+    printf( "%-9s %-11s %12s %10s %12s %10s %12s %9s %7s\n", "LP", "event", "forward", "cycles",
+	    "reverse", "cycles", "committed", "rollback", "share" );
+
+    for( c = 0; c < PROFILE_CLASSES; c++ )
+      for( t = 0; t < PROFILE_TYPES; t++ )
+	{
+	  double * p = total[ c ][ t ];
+	  char name[ 16 ];
+
+	  if( p[ PROFILE_FORWARD ] == 0 )
+	     continue;
+
+	  if( t < n_types )
+	     snprintf( name, sizeof(name), "%s", type_names[ t ] );
+	  else
+	     snprintf( name, sizeof(name), "%d", t );
+
+	  printf( "%-9s %-11s %12.0lf %10.1lf %12.0lf %10.1lf %12.0lf %9.4lf %7.4lf\n",
+		  class_names[ c ], name,
+		  p[ PROFILE_FORWARD ], p[ PROFILE_FORWARD_CYCLES ] / p[ PROFILE_FORWARD ],
+		  p[ PROFILE_REVERSE ], p[ PROFILE_REVERSE ] ? p[ PROFILE_REVERSE_CYCLES ] / p[ PROFILE_REVERSE ] : 0,
+		  p[ PROFILE_COMMIT ], p[ PROFILE_REVERSE ] / p[ PROFILE_FORWARD ],
+		  all_cycles ? ( p[ PROFILE_FORWARD_CYCLES ] + p[ PROFILE_REVERSE_CYCLES ] ) / all_cycles : 0 );
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef INC_dragonfly_profile_h
+#define INC_dragonfly_profile_h
+
+#include <ross.h>
+
+/* Handler cost and rollback profile of the dragonfly model (--profile=1). For every LP class and
+ * event type it counts forward, reverse and commit calls and sums the cycles spent in the forward
+ * and reverse handlers. Forward calls that were rolled back are re-executed, so forward calls =
+ * committed + rolled back. The counters of all ranks are summed with one reduction at the end. */
+
+enum dragonfly_profile_class
+{
+  PROFILE_TERMINAL,
+  PROFILE_ROUTER,
+  PROFILE_MPI,
+  PROFILE_CLASSES
+};
+
+/* event types are event_t values below this */
+#define PROFILE_TYPES 16
+
+void dragonfly_profile_forward( int lp_class, int type, tw_clock cycles );
+void dragonfly_profile_reverse( int lp_class, int type, tw_clock cycles );
+void dragonfly_profile_commit( int lp_class, int type );
+
+/* reduces the counters and prints one line per class and event type that occurred on the master,
+ * type_names holds the names of the n_types event types */
+void dragonfly_profile_report( const char * const * type_names, int n_types );
+
+#endif
@@ -0,0 +1,154 @@
+#include "dragonfly-stats.h"
+
+/* buffer layout: generated[n_points], finished[n_points], latency_hist, n_finished, hops,
+ * latency_sum, router_sends, fast_hops and max_latency last, see stats_combine */
+#define STATS_SCALARS 6
+
+static double * stats_buffer = NULL;
+static int stats_points = 0;
+static int stats_length = 0;
+static tw_stime stats_end_time;
+static tw_stime stats_latency_bin;
+
+static dragonfly_stats stats_total;
+
+/* points the fields of s into a packed buffer */
+static void
+stats_unpack( dragonfly_stats * s,
+	      double * buffer )
+{
+    double * scalars = buffer + 2 * stats_points + STATS_LATENCY_BINS;
+
+    s->generated = buffer;
+    s->finished = buffer + stats_points;
+    memcpy( s->latency_hist, buffer + 2 * stats_points, sizeof(s->latency_hist) );
+    s->n_finished = scalars[ 0 ];
+    s->hops = scalars[ 1 ];
+    s->latency_sum = scalars[ 2 ];
+    s->router_sends = scalars[ 3 ];
+    s->fast_hops = scalars[ 4 ];
+    s->max_latency = scalars[ 5 ];
+}
+
+void
+dragonfly_stats_init( int n_points,
+		      tw_stime end_time,
+		      tw_stime latency_bin )
+{
+    stats_points = n_points;
+    stats_length = 2 * n_points + STATS_LATENCY_BINS + STATS_SCALARS;
+    stats_end_time = end_time;
+    stats_latency_bin = latency_bin;
+    stats_buffer = tw_calloc(TW_LOC, "dragonfly stats", sizeof(double), stats_length);
+}
+
+/* interval of time t, committed events are always before the end time */
+static int
+stats_index( tw_stime t )
+{
+    int index = floor( stats_points * ( t / stats_end_time ) );
+
+    if( index >= stats_points )
+       index = stats_points - 1;
+    return index;
+}
+
+void
+dragonfly_stats_generated( tw_stime t )
+{
+    stats_buffer[ stats_index( t ) ]++;
+}
+
+void
+dragonfly_stats_finished( tw_stime t,
+			  tw_stime latency,
+			  int hops )
+{
+    double * scalars = stats_buffer + 2 * stats_points + STATS_LATENCY_BINS;
+
+    stats_buffer[ stats_points + stats_index( t ) ]++;
+    latency_hist_add( stats_buffer + 2 * stats_points, STATS_LATENCY_BINS, stats_latency_bin, latency );
+    scalars[ 0 ]++;
+    scalars[ 1 ] += hops;
+    scalars[ 2 ] += latency;
+    if( scalars[ 5 ] < latency )
+       scalars[ 5 ] = latency;
+}
+
+void
+dragonfly_stats_router_send( int fast )
+{
+    double * scalars = stats_buffer + 2 * stats_points + STATS_LATENCY_BINS;
+
+    scalars[ 3 ]++;
+    scalars[ 4 ] += fast;
+}
+
+/* reduction operator over whole buffers: sums every field, takes the maximum of the last */
+static void
+stats_combine( void * in,
+	       void * inout,
+	       int * len,
+	       MPI_Datatype * type )
+{
+    double * a = in;
+    double * b = inout;
+    int i, j;
+
+    /* always the contiguous buffer type of dragonfly_stats_reduce */
+    (void)type;
+
+    for( j = 0; j < *len; j++, a += stats_length, b += stats_length )
+      {
+	for( i = 0; i < stats_length - 1; i++ )
+	   b[ i ] += a[ i ];
+	if( b[ i ] < a[ i ] )
+	   b[ i ] = a[ i ];
+      }
+}
+
+dragonfly_stats *
+dragonfly_stats_reduce( void )
+{
+    double * total = NULL;
+    MPI_Datatype buffer_type;
+    MPI_Op combine;
+
+    if( tw_ismaster() )
+       total = tw_calloc(TW_LOC, "dragonfly stats", sizeof(double), stats_length);
+
+    MPI_Type_contiguous( stats_length, MPI_DOUBLE, &buffer_type );
+    MPI_Type_commit( &buffer_type );
+    MPI_Op_create( stats_combine, 1, &combine );
+
+    MPI_Reduce( stats_buffer, total, 1, buffer_type, combine, 0, MPI_COMM_WORLD );
+
+    MPI_Op_free( &combine );
+    MPI_Type_free( &buffer_type );
+
+    if( !total )
+       return NULL;
+
+    stats_unpack( &stats_total, total );
+    return &stats_total;
+}
+
+tw_stime
+dragonfly_stats_percentile( const dragonfly_stats * s,
+			    double q,
+			    int * overflow )
+{
+    return latency_hist_percentile( s->latency_hist, STATS_LATENCY_BINS, stats_latency_bin,
+				    s->n_finished, q, overflow );
+}
+
+void
+dragonfly_stats_print_percentile( const char * name,
+				  const dragonfly_stats * s,
+				  double q )
+{
+    int overflow;
+    tw_stime value = dragonfly_stats_percentile( s, q, &overflow );
+
+    latency_hist_print( name, value, overflow );
+}
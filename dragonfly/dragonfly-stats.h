@@ -0,0 +1,48 @@
+#ifndef INC_dragonfly_stats_h
+#define INC_dragonfly_stats_h
+
+#include <ross.h>
+#include "latency-hist.h"
+
+/* End of run statistics of the dragonfly model. Samples are only recorded from commit handlers,
+ * so rolled back events never count and nothing has to be undone by hand. Every PE packs its
+ * counters into one buffer of doubles and dragonfly_stats_reduce() combines all of them with a
+ * single reduction whose operator sums every field except the maximum latency. */
+
+/* latency histogram, the last bin also counts all longer latencies */
+#define STATS_LATENCY_BINS 256
+
+typedef struct dragonfly_stats dragonfly_stats;
+
+struct dragonfly_stats
+{
+  /* packets generated and finished in each of the n_points intervals, not cumulative */
+  double * generated;
+  double * finished;
+  double latency_hist[ STATS_LATENCY_BINS ];
+  double n_finished;
+  double hops;
+  double latency_sum;
+  /* chunks sent by routers, and those that took the fast path (--fast_path) */
+  double router_sends;
+  double fast_hops;
+  double max_latency;
+};
+
+/* n_points intervals over [0, end_time), latencies are binned latency_bin wide */
+void dragonfly_stats_init( int n_points, tw_stime end_time, tw_stime latency_bin );
+
+void dragonfly_stats_generated( tw_stime t );
+void dragonfly_stats_finished( tw_stime t, tw_stime latency, int hops );
+void dragonfly_stats_router_send( int fast );
+
+/* combines the statistics of all PEs, returns them on the master (NULL elsewhere) */
+dragonfly_stats * dragonfly_stats_reduce( void );
+
+/* the q quantile (0 < q <= 1) of the latencies, see latency_hist_percentile() */
+tw_stime dragonfly_stats_percentile( const dragonfly_stats * s, double q, int * overflow );
+
+/* prints the q quantile as " name value" or " name >=value" */
+void dragonfly_stats_print_percentile( const char * name, const dragonfly_stats * s, double q );
+
+#endif
@@ -0,0 +1,60 @@
+/* Prints a binary dragonfly event trace as text, one event per line:
+ *   time lp event packet_ID port
+ * With a packet ID only the events of that packet are printed.
+ * Usage: dragonfly-trace-decode trace.<rank> [packet_ID] */
+#include <stdio.h>
+#include <stdlib.h>
+#include "dragonfly-trace.h"
+
+/* in the order of event_t in dragonfly.h */
+static const char * event_names[] =
+{
+  "RESCHEDULE", "T_GENERATE", "T_ARRIVE", "T_SEND", "R_SEND", "R_ARRIVE",
+  "BUFFER", "WAIT", "FINISH", "MPI_SEND", "MPI_RECV"
+};
+
+int
+main( int argc, char ** argv )
+{
+    FILE * in;
+    unsigned int header[ 4 ];
+    dragonfly_trace_record r;
+    unsigned long long packet = 0;
+    int filter = argc == 3;
+    int n_names = sizeof(event_names) / sizeof(event_names[ 0 ]);
+
+    if( argc != 2 && argc != 3 )
+      {
+	fprintf( stderr, "usage: %s trace.<rank> [packet_ID]\n", argv[ 0 ] );
+	return 1;
+      }
+    if( filter )
+       packet = strtoull( argv[ 2 ], NULL, 10 );
+
+    if( !( in = fopen( argv[ 1 ], "rb" ) ) )
+      {
+	perror( argv[ 1 ] );
+	return 1;
+      }
+
+    if( fread( header, sizeof(unsigned int), 4, in ) != 4 || header[ 0 ] != DRAGONFLY_TRACE_MAGIC
+	|| header[ 1 ] != DRAGONFLY_TRACE_VERSION || header[ 3 ] != sizeof(dragonfly_trace_record) )
+      {
+	fprintf( stderr, "%s is not a dragonfly event trace\n", argv[ 1 ] );
+	return 1;
+      }
+
+    printf( "# rank %u\n# time lp event packet_ID port\n", header[ 2 ] );
+    while( fread( &r, sizeof(r), 1, in ) == 1 )
+      {
+	if( filter && r.packet_ID != packet )
+	   continue;
+
+	if( r.type >= 0 && r.type < n_names )
+	   printf( "%lf %u %s %llu %d\n", r.time, r.lp, event_names[ r.type ], r.packet_ID, r.port );
+	else
+	   printf( "%lf %u %d %llu %d\n", r.time, r.lp, r.type, r.packet_ID, r.port );
+      }
+    fclose( in );
+    return 0;
+}
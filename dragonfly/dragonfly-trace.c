@@ -0,0 +1,121 @@
+#include <ross.h>
+#include <pthread.h>
+#include "dragonfly-trace.h"
+
+#define TRACE_HALF ( DRAGONFLY_TRACE_RING / 2 )
+
+static FILE * trace_file = NULL;
+static dragonfly_trace_record * trace_ring;
+
+/* half of the ring being filled and the number of records in it */
+static int trace_half = 0;
+static long trace_fill = 0;
+
+/* half handed to the writer thread, -1 while the writer is idle */
+static int trace_pending = -1;
+static int trace_done = 0;
+static pthread_t trace_writer;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_cond = PTHREAD_COND_INITIALIZER;
+
+static void *
+trace_writer_main( void * arg )
+{
+    int half;
+
+    (void)arg;
+
+    pthread_mutex_lock( &trace_lock );
+    for( ;; )
+      {
+	while( trace_pending < 0 && !trace_done )
+	   pthread_cond_wait( &trace_cond, &trace_lock );
+	if( trace_pending < 0 )
+	   break;
+
+	half = trace_pending;
+	pthread_mutex_unlock( &trace_lock );
+
+	fwrite( trace_ring + half * TRACE_HALF, sizeof(dragonfly_trace_record), TRACE_HALF, trace_file );
+
+	pthread_mutex_lock( &trace_lock );
+	trace_pending = -1;
+	pthread_cond_broadcast( &trace_cond );
+      }
+    pthread_mutex_unlock( &trace_lock );
+    return NULL;
+}
+
+void
+dragonfly_trace_open( const char * prefix,
+		      int rank )
+{
+    char name[ 1024 ];
+    unsigned int header[ 4 ];
+
+    snprintf( name, sizeof(name), "%s.%d", prefix, rank );
+    trace_file = fopen( name, "wb" );
+    if( !trace_file )
+       tw_error(TW_LOC, "\n Cannot open event trace %s ", name);
+
+    header[ 0 ] = DRAGONFLY_TRACE_MAGIC;
+    header[ 1 ] = DRAGONFLY_TRACE_VERSION;
+    header[ 2 ] = rank;
+    header[ 3 ] = sizeof(dragonfly_trace_record);
+    fwrite( header, sizeof(unsigned int), 4, trace_file );
+
+    trace_ring = tw_calloc(TW_LOC, "event trace ring", sizeof(dragonfly_trace_record), DRAGONFLY_TRACE_RING);
+
+    if( pthread_create( &trace_writer, NULL, trace_writer_main, NULL ) != 0 )
+       tw_error(TW_LOC, "\n Cannot start the event trace writer ");
+}
+
+void
+dragonfly_trace_record_event( double time,
+			      unsigned int lp,
+			      int type,
+			      unsigned long long packet_ID,
+			      int port )
+{
+    dragonfly_trace_record * r = &trace_ring[ trace_half * TRACE_HALF + trace_fill ];
+
+    r->time = time;
+    r->packet_ID = packet_ID;
+    r->lp = lp;
+    r->type = type;
+    r->port = port;
+
+    if( ++trace_fill < TRACE_HALF )
+       return;
+
+    /* hand the full half to the writer, waiting only if it is still busy with the other one */
+    pthread_mutex_lock( &trace_lock );
+    while( trace_pending >= 0 )
+       pthread_cond_wait( &trace_cond, &trace_lock );
+    trace_pending = trace_half;
+    pthread_cond_broadcast( &trace_cond );
+    pthread_mutex_unlock( &trace_lock );
+
+    trace_half ^= 1;
+    trace_fill = 0;
+}
+
+void
+dragonfly_trace_close( void )
+{
+    if( !trace_file )
+       return;
+
+    pthread_mutex_lock( &trace_lock );
+    while( trace_pending >= 0 )
+       pthread_cond_wait( &trace_cond, &trace_lock );
+    trace_done = 1;
+    pthread_cond_broadcast( &trace_cond );
+    pthread_mutex_unlock( &trace_lock );
+    pthread_join( trace_writer, NULL );
+
+    fwrite( trace_ring + trace_half * TRACE_HALF, sizeof(dragonfly_trace_record), trace_fill, trace_file );
+    fclose( trace_file );
+    trace_file = NULL;
+    free( trace_ring );
+}
@@ -0,0 +1,39 @@
+#ifndef INC_dragonfly_trace_h
+#define INC_dragonfly_trace_h
+
+/* Binary event trace of the dragonfly model (--event_trace=PREFIX), one file PREFIX.<rank> per rank:
+ *   header:  uint32 magic DRAGONFLY_TRACE_MAGIC, uint32 version, uint32 rank, uint32 record size
+ *   records: dragonfly_trace_record in commit order
+ * Events are recorded from the commit handlers, so rolled back events never reach the trace.
+ * Records go to a ring of two halves: when one half is full a writer thread flushes it to the
+ * file while the simulation fills the other one. dragonfly-trace-decode prints a trace as text. */
+#define DRAGONFLY_TRACE_MAGIC 0x52544644
+#define DRAGONFLY_TRACE_VERSION 1
+
+/* records in the ring, half of it is flushed at a time */
+#define DRAGONFLY_TRACE_RING 65536
+
+typedef struct dragonfly_trace_record dragonfly_trace_record;
+
+struct dragonfly_trace_record
+{
+  /* receive time of the event in ns */
+  double time;
+  unsigned long long packet_ID;
+  /* global LP id */
+  unsigned int lp;
+  /* event_t of the event */
+  short type;
+  /* channel the event works on, -1 when it has none */
+  short port;
+};
+
+/* opens PREFIX.<rank> and starts the writer thread */
+void dragonfly_trace_open( const char * prefix, int rank );
+
+void dragonfly_trace_record_event( double time, unsigned int lp, int type, unsigned long long packet_ID, int port );
+
+/* flushes the records left in the ring and closes the file */
+void dragonfly_trace_close( void );
+
+#endif
@@ -1,4 +1,7 @@
 #include "dragonfly.h"
+#include "dragonfly-trace.h"
+#include "dragonfly-profile.h"
+#include "dragonfly-stats.h"
 
 // Local router ID: 0 --- total_router-1
 // Router LP ID 
@@ -6,7 +9,6 @@
 
 ////////////////////////////////////////////////// Router-Group-Terminal mapping functions ///////////////////////////////////////
 
-FILE * dragonfly_event_log=NULL;
 int 
 get_terminal_rem()
 {
@@ -50,7 +52,128 @@ getRouterID(tw_lpid terminal_id)
 {
     int tid = getTerminalID(terminal_id);
 
-    return tid/NUM_TERMINALS; 
+    return tid/num_terminal; 
+}
+
+///////////////////////////////////////// Group mapping /////////////////////////////////////////
+/* rank holding item index when total items are split into contiguous ranges over ranks,
+   the first total % ranks ranks hold one item more */
+int
+split_rank(int index, 
+	   int total, 
+	   int ranks)
+{
+   int base = total / ranks;
+   int rem = total % ranks;
+
+   if(index < rem * (base + 1))
+      return index / (base + 1);
+
+   return rem + (index - rem * (base + 1)) / base;
+}
+
+/* first item of a rank in the split above */
+int
+split_first(int rank, 
+	    int total, 
+	    int ranks)
+{
+   return rank * (total / ranks) + ROSS_MIN(rank, total % ranks);
+}
+
+/* group of a router, terminal or MPI process LP */
+int
+lp_group(tw_lpid gid)
+{
+   if(gid < total_routers)
+      return gid / num_router;
+
+   if(gid < total_routers + total_terminals)
+      return getTerminalID(gid) / (num_router * num_terminal);
+
+   return getProcID(gid) / (num_router * num_terminal);
+}
+
+/* rank of an LP with the group mapping (group) or with the linear split of every LP type */
+int
+lp_rank(tw_lpid gid, 
+	int group)
+{
+   int ranks = tw_nnodes();
+
+   if(group)
+      return split_rank(lp_group(gid), num_groups, ranks);
+
+   if(gid < total_routers)
+      return split_rank(gid, total_routers, ranks);
+
+   if(gid < total_routers + total_terminals)
+      return split_rank(getTerminalID(gid), total_terminals, ranks);
+
+   return split_rank(getProcID(gid), total_mpi_procs, ranks);
+}
+
+/* Fraction of hop events crossing ranks: every router counts its local, global and terminal
+   channels and every terminal its router and MPI process, in both directions */
+double
+remote_link_fraction(int group)
+{
+   int * global_channel = tw_calloc(TW_LOC, "global channels", sizeof(int), num_global_channel);
+   long remote = 0, total = 0;
+   int r, j;
+
+   for(r = 0; r < total_routers; r++)
+    {
+      int group_begin = (r / num_router) * num_router;
+      int rank = lp_rank(r, group);
+
+      for(j = group_begin; j < group_begin + num_router; j++)
+	if(j != r)
+	 {
+	   remote += rank != lp_rank(j, group);
+	   total++;
+	 }
+
+      router_global_channels(r, global_channel);
+      for(j = 0; j < num_global_channel; j++)
+       {
+	 remote += rank != lp_rank(global_channel[j], group);
+	 total++;
+       }
+
+      for(j = 0; j < num_terminal; j++)
+       {
+	 tw_lpid terminal = total_routers + r * num_terminal + j;
+	 int terminal_rank = lp_rank(terminal, group);
+
+	 // router to terminal and back, terminal to MPI process and back
+	 remote += 2 * (rank != terminal_rank);
+	 remote += 2 * (terminal_rank != lp_rank(terminal + total_terminals, group));
+	 total += 4;
+       }
+    }
+   free(global_channel);
+   return (double)remote / total;
+}
+
+/* first router, terminal and MPI process LP of this PE */
+void
+local_lp_begin(tw_lpid * router_begin, 
+	       tw_lpid * terminal_begin, 
+	       tw_lpid * mpi_begin)
+{
+   if(group_mapping)
+    {
+      int first_group = split_first(g_tw_mynode, num_groups, tw_nnodes());
+
+      *router_begin = first_group * num_router;
+      *terminal_begin = total_routers + first_group * num_router * num_terminal;
+      *mpi_begin = total_routers + total_terminals + first_group * num_router * num_terminal;
+      return;
+    }
+   *router_begin = g_tw_mynode * nlp_router_per_pe + get_router_rem();
+   *terminal_begin = total_routers + g_tw_mynode * nlp_terminal_per_pe + get_terminal_rem();
+   *mpi_begin = total_routers + total_terminals + g_tw_mynode * nlp_mpi_procs_per_pe + get_terminal_rem();
 }
 
 tw_peid 
@@ -62,6 +185,9 @@ mapping( tw_lpid gid)
    int nlp_per_pe;
    int N_nodes = tw_nnodes();
 
+   if(group_mapping)
+      return lp_rank(gid, 1);
+
    if(gid < total_routers)
     {
        rank = gid / nlp_router_per_pe;
@@ -123,17 +249,17 @@ tw_lpid
 getRouterFromGroupID(int gid, 
 		    router_state * r)
 {
-  int group_begin=r->group_id*NUM_ROUTER;
-  int group_end=(r->group_id*NUM_ROUTER) + NUM_ROUTER-1;
-  int offset=(gid*NUM_ROUTER-group_begin)/NUM_ROUTER;
+  int group_begin=r->group_id*num_router;
+  int group_end=(r->group_id*num_router) + num_router-1;
+  int offset=(gid*num_router-group_begin)/num_router;
   
-  if((gid * NUM_ROUTER) < group_begin)
-    offset=(group_begin-gid*NUM_ROUTER)/NUM_ROUTER; // take absolute value
+  if((gid * num_router) < group_begin)
+    offset=(group_begin-gid*num_router)/num_router; // take absolute value
   
-  int half_channel=GLOBAL_CHANNELS/2;
-  int index=(offset-1)/(half_channel * NUM_ROUTER);
+  int half_channel=num_global_channel/2;
+  int index=(offset-1)/(half_channel * num_router);
   
-  offset=(offset-1)%(half_channel * NUM_ROUTER);
+  offset=(offset-1)%(half_channel * num_router);
 
   // If the destination router is in the same group
   tw_lpid router_id;
@@ -146,6 +272,135 @@ getRouterFromGroupID(int gid,
   return router_id;
 }	
 
+///////////////////////////////////////// Traffic tables /////////////////////////////////////////
+/* Destination of every MPI process of this PE, built once by traffic_setup. For the fixed patterns
+   (TRANSPOSE, NEAREST_NEIGHBOR, NEAREST_ROUTER, --traffic_file) the entry is the destination terminal
+   LP or TRAFFIC_NONE when the process sends nothing. For WORST_CASE it is the first terminal of the
+   destination group, for BISECTION the first terminal of the group used when the drawn group is the
+   process's own. UNIFORM_RANDOM needs no table. */
+#define TRAFFIC_NONE ((tw_lpid) -1)
+
+static tw_lpid * traffic_dest = NULL;
+static tw_lpid traffic_begin;
+
+/* first terminal LP of group g */
+tw_lpid
+group_first_terminal(int g)
+{
+   return total_routers + (tw_lpid)g * num_terminal * num_router;
+}
+
+/* destination table entry of the MPI process gid for the synthetic patterns */
+tw_lpid
+traffic_destination(tw_lpid gid)
+{
+   int proc = getProcID(gid);
+   int router_id = proc / num_terminal;
+   int group_id = proc / (num_terminal * num_router);
+   int local_offset = proc % num_terminal;
+   int row, col;
+
+   switch(traffic)
+    {
+      case WORST_CASE:
+	return group_first_terminal((group_id + 1) % num_groups);
+
+      case BISECTION:
+	return group_first_terminal((group_id + (num_groups/2)) % num_groups);
+
+      case TRANSPOSE:
+	row = proc / (num_router * num_terminal);
+	col = proc % (num_router * num_terminal + 1);
+	if(row == col)
+	   return TRAFFIC_NONE;
+	return total_routers + (col * num_router * num_terminal + row);
+
+      // terminal of the same router, wraps into the next router for the first terminal and from the
+      // last terminal to the first one
+      case NEAREST_NEIGHBOR:
+	return total_routers + ((router_id * num_terminal) + (num_terminal - local_offset)) % total_terminals;
+
+      case NEAREST_ROUTER:
+	return total_routers + ((((router_id + 1) % total_routers) * num_terminal) + (num_terminal - local_offset)) % total_terminals;
+    }
+   return TRAFFIC_NONE;
+}
+
+/* Reads a permutation file: whitespace separated terminal IDs (0 .. total_terminals-1), the i-th is
+   the destination of MPI process i, -1 for a process that sends nothing. The master parses the file
+   and hands every rank only the range of its n processes. */
+void
+traffic_read(const char * file, int n)
+{
+   long long * all = NULL;
+   long long * local = tw_calloc(TW_LOC, "traffic file", sizeof(long long), n);
+   int * ranges = NULL;
+   int * counts = NULL;
+   int * displs = NULL;
+   int range[2], n_ranks, i;
+
+   // first process and number of processes of every rank
+   range[0] = traffic_begin - total_routers - total_terminals;
+   range[1] = n;
+   MPI_Comm_size(MPI_COMM_WORLD, &n_ranks);
+   if(tw_ismaster())
+      ranges = tw_calloc(TW_LOC, "traffic file", sizeof(int), 2 * n_ranks);
+   MPI_Gather(range, 2, MPI_INT, ranges, 2, MPI_INT, 0, MPI_COMM_WORLD);
+
+   if(tw_ismaster())
+    {
+      FILE * f = fopen(file, "r");
+
+      if(!f)
+	 tw_error(TW_LOC, "\n Cannot open traffic file %s ", file);
+
+      all = tw_calloc(TW_LOC, "traffic file", sizeof(long long), total_mpi_procs);
+      for(i = 0; i < total_mpi_procs; i++)
+       {
+	 if(fscanf(f, "%lld", &all[i]) != 1)
+	    tw_error(TW_LOC, "\n Traffic file %s has %d destinations, %d MPI processes ", file, i, total_mpi_procs);
+	 if(all[i] < -1 || all[i] >= total_terminals)
+	    tw_error(TW_LOC, "\n Traffic file %s: destination %lld of MPI process %d is not a terminal ", file, all[i], i);
+       }
+      fclose(f);
+
+      counts = tw_calloc(TW_LOC, "traffic file", sizeof(int), n_ranks);
+      displs = tw_calloc(TW_LOC, "traffic file", sizeof(int), n_ranks);
+      for(i = 0; i < n_ranks; i++)
+       {
+	 displs[i] = ranges[2 * i];
+	 counts[i] = ranges[2 * i + 1];
+       }
+    }
+   MPI_Scatterv(all, counts, displs, MPI_LONG_LONG, local, n, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+   for(i = 0; i < n; i++)
+      traffic_dest[i] = local[i] < 0 ? TRAFFIC_NONE : total_routers + local[i];
+
+   free(all);
+   free(ranges);
+   free(counts);
+   free(displs);
+   free(local);
+}
+
+/* builds the destination table of the n MPI processes of this PE */
+void
+traffic_setup(int n)
+{
+   tw_lpid router_begin, terminal_begin;
+   int i;
+
+   local_lp_begin(&router_begin, &terminal_begin, &traffic_begin);
+   traffic_dest = tw_calloc(TW_LOC, "traffic table", sizeof(tw_lpid), n);
+
+   if(traffic == TRAFFIC_FILE)
+      traffic_read(traffic_file, n);
+   else
+      for(i = 0; i < n; i++)
+	 traffic_dest[i] = traffic_destination(traffic_begin + i);
+}
+
 /////////////////////////////////////////////////////////////////MPI related functions /////////////////////////////////////////////////////
 
 /* Initializes the MPI process LP */
@@ -167,11 +422,11 @@ mpi_init( process_state * s,
     tw_event_send(e);
 
     s->message_counter = 0;
-    s->router_id = (lp->gid - total_routers - total_terminals) / NUM_TERMINALS;
-    s->group_id = (lp->gid - total_routers - total_terminals) / (NUM_TERMINALS * NUM_ROUTER);
+    s->router_id = (lp->gid - total_routers - total_terminals) / num_terminal;
+    s->group_id = (lp->gid - total_routers - total_terminals) / (num_terminal * num_router);
 
-    s->row = getProcID(lp->gid) / NUM_ROWS;
-    s->col = getProcID(lp->gid) % NUM_COLS;
+    s->row = getProcID(lp->gid) / (num_router * num_terminal);
+    s->col = getProcID(lp->gid) % (num_router * num_terminal + 1);
 }
 
 /* Starts generating MPI messages at the MPI process LP according to the traffic pattern */
@@ -187,8 +442,8 @@ mpi_msg_send( process_state * s,
   terminal_message *m;
   int i;
    
-  int terminal_grp_id = ((int)lp->gid - total_routers - total_terminals)/ (NUM_TERMINALS * NUM_ROUTER);
-  int offset = NUM_TERMINALS * NUM_ROUTER - 1;
+  int terminal_grp_id = ((int)lp->gid - total_routers - total_terminals)/ (num_terminal * num_router);
+  int offset = num_terminal * num_router - 1;
   bf->c1 = 0;
   bf->c3 = 0;
   bf->c2 = 0;
@@ -206,19 +461,13 @@ mpi_msg_send( process_state * s,
 	   {
 		 bf->c3 = 1;
 		 bf->c2 = 1;
-		 int group_id = tw_rand_integer(lp->rng, 0, num_groups);
-		
-		 if(group_id == s->group_id)
-			group_id = (s->group_id + (num_groups/2)) % num_groups;
-
-  		 int next_group_begin = group_id * NUM_TERMINALS * NUM_ROUTER;
+		 int group_id = tw_rand_integer(lp->rng, 0, num_groups - 1);
+		 tw_lpid next_group_begin = traffic_dest[lp->gid - traffic_begin];
 
-		 dst_lp = tw_rand_integer(lp->rng, total_routers + next_group_begin, total_routers + next_group_begin + offset);
+		 if(group_id != s->group_id)
+			next_group_begin = group_first_terminal(group_id);
 
-	/*	 if(dst_lp == lp->gid)
- 		  {
-			dst_lp = total_routers + next_group_begin + (lp->gid - total_routers) % (NUM_TERMINALS * NUM_ROUTER);	
-		  }*/
+		 dst_lp = tw_rand_integer(lp->rng, next_group_begin, next_group_begin + offset);
 	   }
 	  break;
 
@@ -228,9 +477,9 @@ two groups which is why this traffic is called worst-case traffic */
 	  {
 		bf->c3 = 1;
 
-		int next_group_begin = ((s->group_id + 1) % num_groups) * NUM_TERMINALS * NUM_ROUTER;
+		tw_lpid next_group_begin = traffic_dest[lp->gid - traffic_begin];
 
-		dst_lp = tw_rand_integer(lp->rng, total_routers + next_group_begin, total_routers + next_group_begin + offset);
+		dst_lp = tw_rand_integer(lp->rng, next_group_begin, next_group_begin + offset);
 	  }
 	break;
 /* uniform random sends MPI messages to a randomly selected compute node/terminal from the entire network */
@@ -247,54 +496,19 @@ two groups which is why this traffic is called worst-case traffic */
 	   }
 	 break;
 
-	case TRANSPOSE:
+/* TRANSPOSE, NEAREST_NEIGHBOR (terminals of the same router), NEAREST_ROUTER and --traffic_file have a fixed destination per process */
+	default:
 	   {
-		if( s->col == s->row )
+		dst_lp = traffic_dest[lp->gid - traffic_begin];
+
+		if(dst_lp == TRAFFIC_NONE)
 		  {
 		   bf->c1 = 1;
 
 		   return;
 		  }
-	        dst_lp = total_routers +  (s->col * NUM_ROWS + s->row);
 	   }
 	 break;
-/* Sends messages to compute nodes connected to the same dragonfly router */
-      case NEAREST_NEIGHBOR:
-	 {
-	   //bf->c3 = 1;
-	  
-	   int local_offset = (lp->gid - total_routers) % NUM_TERMINALS;
-	   int group_begin = total_routers + (s->router_id * NUM_TERMINALS);
-	   dst_lp = group_begin + (NUM_TERMINALS - local_offset);
-	   if(dst_lp < group_begin || dst_lp > group_begin + offset)
-		printf("\n Incorrect destination for %d to %d ", (int)lp->gid - total_routers, (int)dst_lp - total_routers);
-//	   dst_lp = total_routers + tw_rand_integer(lp->rng, s->router_id * NUM_TERMINALS, (s->router_id + 1) * NUM_TERMINALS -1);
-	
-	   //if(dst_lp == lp->gid)
-	   //  dst_lp = total_routers + s->router_id * NUM_TERMINALS + ((lp->gid+1) % NUM_TERMINALS);	  
-
-	   /*if(dst_lp == lp->gid)
-	    {
-	//	bf->c2 = 0;
-
-	//	dst_lp = total_routers + tw_rand_integer(lp->rng, s->router_id * NUM_TERMINALS, (s->router_id + 1) * NUM_TERMINALS -1);
-		dst_lp = total_routers + ((lp->gid+1) % total_terminals);
-	    }*/
-	}
-	break;
-/* Sends messages to compute nodes connected to nearest dragonfly router */
-    case NEAREST_ROUTER:
-	{
-		int local_offset = (lp->gid - total_routers) % NUM_TERMINALS;
-		int next_router_begin = total_routers + (((s->router_id + 1 ) % total_routers)* NUM_TERMINALS);
-		dst_lp = next_router_begin + (NUM_TERMINALS - local_offset);
-		if(dst_lp < next_router_begin || dst_lp > next_router_begin + NUM_TERMINALS)
-                  printf("\n Incorrect destination for %d to %d ", (int)lp->gid - total_routers, (int)dst_lp - total_routers);
-	}
-	break;
-
-    DEFAULT:
-	      printf("\n Undefined traffic pattern!");
     }
 /*  Generate packets  of PACKET_SIZE
   one MPI message can be much larger than the packet size 
@@ -320,10 +534,6 @@ two groups which is why this traffic is called worst-case traffic */
     m->packet_ID = packet_offset * ( lp->gid - total_routers - total_terminals ) + s->message_counter;
     m->travel_start_time = tw_now(lp);
 
-#if DEBUG
-if(m->packet_ID == TRACK && msg->chunk_id == num_chunks-1)
-   printf("\n MPI message generated ID %lld destination %d ", m->packet_ID, m->dest_terminal_id);
-#endif
     tw_event_send( e );
   }
   ts = MEAN_INTERVAL + tw_rand_exponential( lp->rng, MEAN_INTERVAL/100 );
@@ -350,6 +560,7 @@ mpi_event( process_state * s,
               tw_lp * lp )
 {
   *(int *)bf = (int)0;
+  msg->event_time = tw_now(lp);
   switch(msg->type)
    {
     case MPI_SEND:
@@ -431,8 +642,6 @@ void packet_generate(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_
 	int chan=-1, j;
 	for(j=0; j<NUM_VC; j++)
 	 {
-	   //if(s->vc_occupancy[j] >= TERMINAL_THRESHOLD)
-	   //  fprintf( dragonfly_event_log, " \n Dragonfly compute node buffer size %d terminal ID %d time stamp %lf ", s->vc_occupancy[j], lp->gid - total_routers, tw_now(lp));
 	     if(s->vc_occupancy[j] < TERMINAL_VC_SIZE * num_chunks)
 	      {
 	       chan=j;
@@ -450,7 +659,7 @@ void packet_generate(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_
        m->saved_vc=0;
        m->chunk_id = i;
        m->output_chan = -1;
-       m->wait_loc = -1;
+       m->wait_rec = NULL;
        msg->saved_vc = 0;
 
        if(chan != -1) // If the input queue is available
@@ -488,11 +697,8 @@ void packet_send(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp *
    if(msg->chunk_id == num_chunks - 1) 
     {
        bf->c3 = 1;
-       int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
        s->packet_counter++;
-       N_generated_storage[index]++;
        //if(s->packet_counter >= max_packets)
-	//fprintf(dragonfly_event_log, " \n terminal %d done injecting packets storage %d time stamp %lf ", lp->gid - total_routers, s->packet_counter, tw_now(lp));
     }
 
 //  Each packet is broken into chunks and then sent over the channel
@@ -503,15 +709,8 @@ void packet_send(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp *
    
    s->terminal_available_time = ROSS_MAX(s->terminal_available_time, tw_now(lp));
    s->terminal_available_time += ts;
-   //fprintf(dragonfly_event_log, " router id %d ", s->router_id);
    e = tw_event_new(s->router_id, s->terminal_available_time - tw_now(lp), lp);
 
-#if DEBUG
-if( msg->packet_ID == TRACK && msg->chunk_id == num_chunks-1)
-  {
-    printf("\n (%lf) [Terminal %d] {Node %d} Packet %lld chunk %d being sent to source router %d Output VC : %d after %lf dest terminal id: %d \n", tw_now(lp), (int)lp->gid - total_routers, (int)g_tw_mynode, msg->packet_ID, msg->chunk_id, (int)s->router_id, (int)msg->saved_vc, s->terminal_available_time - tw_now(lp), msg->dest_terminal_id);
-  }
-#endif
    m = tw_event_data(e);
    m->type = R_ARRIVE;
 
@@ -541,18 +740,6 @@ if( msg->packet_ID == TRACK && msg->chunk_id == num_chunks-1)
 /* flits arrive on the router, when last flit of the packet arrives, packet completion is marked */
 void packet_arrive(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
 {
-#if DEBUG
-if( msg->packet_ID == TRACK && msg->chunk_id == num_chunks-1)
-    {
-	printf( "(%lf) [Terminal %d] packet %lld has arrived  \n",
-              tw_now(lp), (int)lp->gid, msg->packet_ID);
-
-	printf("travel start time is %f\n",
-                msg->travel_start_time);
-
-	printf("My hop now is %d\n",msg->my_N_hop);
-    }
-#endif
 
   // Packet arrives and accumulate # queued
   // Find a queue with an empty buffer slot
@@ -593,42 +780,144 @@ if( msg->packet_ID == TRACK && msg->chunk_id == num_chunks-1)
   tw_event_send(buf_e);
 }
 
-/* Packet has arrived at the final destination. Update simulation statistics */
+/* Packet has arrived at the final destination. The statistics are recorded when the event commits */
 void packet_finish(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
 {
-  N_finished++;
-  bf->c3 = 0;
+}
 
-  int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
-  N_finished_storage[index]++;
-  total_time += (tw_now(lp) - msg->travel_start_time);
-  total_hops += msg->my_N_hop;
+/////////////////// WAiting packets linked list /////////////////////////////
+/* Takes a record from the per-PE slab, growing the slab when it runs dry */
+waiting_packet *
+waiting_packet_alloc()
+{
+   int i;
+   waiting_packet * w;
 
-  if (max_latency < (tw_now(lp) - msg->travel_start_time) )
-   {
-	bf->c3 = 1;	
-	msg->saved_available_time = max_latency;
-	max_latency=tw_now(lp) - msg->travel_start_time;
-//	max_packet = msg->packet_ID;
-   }
+   if(!waiting_free_list)
+    {
+      w = tw_calloc(TW_LOC, "waiting packet slab", sizeof(struct waiting_packet), WAITING_SLAB_SIZE);
+
+      for(i = 0; i < WAITING_SLAB_SIZE - 1; i++)
+	w[i].next = &w[i + 1];
+
+      w[i].next = NULL;
+      waiting_free_list = w;
+      waiting_slab_records += WAITING_SLAB_SIZE;
+    }
+   w = waiting_free_list;
+   waiting_free_list = w->next;
+   w->next = NULL;
+   w->prev = NULL;
+   return w;
 }
 
-/////////////////// WAiting packets linked list /////////////////////////////
+/* Returns a record to the per-PE slab */
 void
-waiting_terminal_packet_free(terminal_state * s, int loc)
+waiting_packet_release(waiting_packet * w)
 {
-  int i, max_count = s->wait_count - 1;
-  
-  for(i = loc; i < max_count; i++) {
-      s->waiting_list[i].chan = s->waiting_list[i + 1].chan;
-      s->waiting_list[i].packet = s->waiting_list[i + 1].packet;
-  }
+   w->prev = NULL;
+   w->next = waiting_free_list;
+   waiting_free_list = w;
+}
 
-  s->waiting_list[max_count].packet = NULL;
-  // 16-05
-  s->waiting_list[max_count].chan = -1;
+/* Copies the routing fields of a waiting packet into a record */
+void
+waiting_packet_store(waiting_packet * w,
+		     const terminal_message * msg)
+{
+   w->travel_start_time = msg->travel_start_time;
+   w->packet_ID = msg->packet_ID;
+   w->dest_terminal_id = msg->dest_terminal_id;
+   w->src_terminal_id = msg->src_terminal_id;
+   w->intm_lp_id = msg->intm_lp_id;
+   w->intm_group_id = msg->intm_group_id;
+   w->my_N_hop = msg->my_N_hop;
+   w->saved_vc = msg->saved_vc;
+   w->last_hop = msg->last_hop;
+   w->chunk_id = msg->chunk_id;
+   w->wait_type = msg->wait_type;
+}
 
-  s->wait_count--;
+/* Writes a released record into the message of the event that sends the packet on */
+void
+waiting_packet_load(const waiting_packet * w,
+		    terminal_message * m)
+{
+   m->travel_start_time = w->travel_start_time;
+   m->packet_ID = w->packet_ID;
+   m->dest_terminal_id = w->dest_terminal_id;
+   m->src_terminal_id = w->src_terminal_id;
+   m->intm_lp_id = w->intm_lp_id;
+   m->intm_group_id = w->intm_group_id;
+   m->my_N_hop = w->my_N_hop;
+   m->saved_vc = w->saved_vc;
+   m->last_hop = w->last_hop;
+   m->chunk_id = w->chunk_id;
+   m->wait_type = w->wait_type;
+   m->wait_rec = NULL;
+}
+
+/* Appends the packet of msg at the tail of a channel FIFO */
+void
+waiting_packet_push_tail(waiting_packet ** head,
+			 waiting_packet ** tail,
+			 terminal_message * msg)
+{
+   waiting_packet * w = waiting_packet_alloc();
+
+   waiting_packet_store(w, msg);
+   w->prev = *tail;
+   if(*tail)
+      (*tail)->next = w;
+   else
+      *head = w;
+   *tail = w;
+}
+
+/* Unlinks the tail of a channel FIFO and returns it to the slab (reverse of push_tail) */
+void
+waiting_packet_pop_tail(waiting_packet ** head,
+			waiting_packet ** tail)
+{
+   waiting_packet * w = *tail;
+
+   *tail = w->prev;
+   if(w->prev)
+      w->prev->next = NULL;
+   else
+      *head = NULL;
+   waiting_packet_release(w);
+}
+
+/* Unlinks the head of a channel FIFO, the record is handed back to the slab on commit */
+waiting_packet *
+waiting_packet_pop_head(waiting_packet ** head,
+			waiting_packet ** tail)
+{
+   waiting_packet * w = *head;
+
+   *head = w->next;
+   if(w->next)
+      w->next->prev = NULL;
+   else
+      *tail = NULL;
+   w->next = NULL;
+   return w;
+}
+
+/* Puts a released record back at the head of its channel FIFO (reverse of pop_head) */
+void
+waiting_packet_push_head(waiting_packet ** head,
+			 waiting_packet ** tail,
+			 waiting_packet * w)
+{
+   w->prev = NULL;
+   w->next = *head;
+   if(w->next)
+      w->next->prev = w;
+   else
+      *tail = w;
+   *head = w;
 }
 
 void
@@ -638,9 +927,8 @@ update_terminal_waiting_list( terminal_state * s,
                         tw_lp * lp )
 {
   bf->c3 = 0;
-  int loc = s->wait_count;
 
-  if(loc >= TERMINAL_WAITING_PACK_COUNT)
+  if(s->wait_count >= TERMINAL_WAITING_PACK_COUNT)
     {
 	bf->c3 = 1;
  	printf(" Terminal reached maximum count of linked list %d ", s->wait_count);
@@ -648,37 +936,37 @@ update_terminal_waiting_list( terminal_state * s,
 	return;
     }
 
-  s->waiting_list[loc].chan = msg->saved_vc;
-  s->waiting_list[loc].packet = msg;
+  waiting_packet_push_tail(&s->wait_head[msg->saved_vc], &s->wait_tail[msg->saved_vc], msg);
   s->wait_count++;
 }
 
-/*Once a credit arrives at the node, this method picks a waiting packet in the injection queue and schedules it */
+/*Once a credit arrives at the node, this method picks the oldest packet waiting on the credited channel and schedules it */
 void
 schedule_terminal_waiting_msg( terminal_state * s,
                            tw_bf * bf,
                            terminal_message * msg,
-                           tw_lp * lp )
+                           tw_lp * lp,
+			   int chan )
 {
   bf->c3 = 0;
-  if( s->wait_count > 0)
+  msg->wait_rec = NULL;
+  if( s->wait_head[chan] )
    {
     bf->c3 = 1;
     tw_event * e_h;
     terminal_message * m;
     tw_stime ts;
+    waiting_packet * w = waiting_packet_pop_head(&s->wait_head[chan], &s->wait_tail[chan]);
+
+    s->wait_count--;
+    msg->wait_rec = w;
+
     ts = 0.1 + tw_rand_exponential(lp->rng, MEAN_INTERVAL/1000);
     e_h = tw_event_new( lp->gid, ts, lp );
     m = tw_event_data(e_h);
-    memcpy(m, s->waiting_list[0].packet, sizeof(terminal_message));
-  
-    memcpy(msg, s->waiting_list[0].packet, sizeof(terminal_message));
-    msg->wait_loc = 0;
-    msg->type = BUFFER;
-  
+    waiting_packet_load(w, m);
     m->type = T_SEND;
     tw_event_send( e_h );
-    waiting_terminal_packet_free(s, 0);
   }
 }
 
@@ -704,22 +992,11 @@ terminal_init( terminal_state * s,
       s->vc_occupancy[i]=0;
       s->output_vc_state[i]=VC_IDLE;
     }
-   s->waiting_list = tw_calloc(TW_LOC, "waiting list", sizeof(struct waiting_packet), TERMINAL_WAITING_PACK_COUNT);
-
-   int j;
-   for (j = 0; j < TERMINAL_WAITING_PACK_COUNT - 1; j++) {
-      s->waiting_list[j].next = &s->waiting_list[j + 1];
-      // 16-05
-      s->waiting_list[j].chan = -1;
-      s->waiting_list[j].packet = NULL;
+   for( i = 0; i < NUM_VC; i++ )
+    {
+      s->wait_head[i] = NULL;
+      s->wait_tail[i] = NULL;
     }
-
-   s->waiting_list[j].next = NULL;
-   s->waiting_list[j].chan = -1;
-   s->waiting_list[j].packet = NULL;
-
-   s->head = &s->waiting_list[0];
-   // 16/05
    s->wait_count = 0;
 }
 
@@ -735,7 +1012,7 @@ terminal_buf_update(terminal_state * s,
     
     s->vc_occupancy[msg_indx]--;
     s->output_vc_state[msg_indx] = VC_IDLE;
-    schedule_terminal_waiting_msg( s, bf, msg, lp );
+    schedule_terminal_waiting_msg( s, bf, msg, lp, msg_indx );
 }
 
 void 
@@ -745,6 +1022,7 @@ terminal_event( terminal_state * s,
 		tw_lp * lp )
 {
   *(int *)bf = (int)0;
+  msg->event_time = tw_now(lp);
   switch(msg->type)
     {
     case T_GENERATE:
@@ -824,7 +1102,6 @@ get_next_stop(router_state * s,
 		      int path)
 {
    int dest_lp;
-   int i;
    int dest_router_id = getRouterID(msg->dest_terminal_id);
    int dest_group_id;
  
@@ -839,7 +1116,7 @@ get_next_stop(router_state * s,
    // Generate inter-mediate destination
    if(msg->last_hop == TERMINAL && path == NON_MINIMAL)
     {
-      if(dest_router_id/NUM_ROUTER != s->group_id)
+      if(dest_router_id/num_router != s->group_id)
          {
             bf->c2 = 1;
             int intm_grp_id = tw_rand_integer(lp->rng, 0, num_groups-1);
@@ -856,7 +1133,7 @@ get_next_stop(router_state * s,
    }
   else
    {
-     dest_group_id = dest_router_id / NUM_ROUTER;
+     dest_group_id = dest_router_id / num_router;
    }
   
   if(s->group_id == dest_group_id)
@@ -865,15 +1142,7 @@ get_next_stop(router_state * s,
    }
    else
    {
-      dest_lp=getRouterFromGroupID(dest_group_id,s);
-      if(dest_lp == lp->gid)
-      {
-        for(i=0; i<GLOBAL_CHANNELS; i++)
-           {
-            if(s->global_channel[i]/NUM_ROUTER == dest_group_id)
-                dest_lp=s->global_channel[i];
-          }
-      }
+      dest_lp = s->route[dest_group_id].next_stop;
    }
   return dest_lp;
 }
@@ -885,27 +1154,24 @@ get_output_port( router_state * s,
 		tw_lp * lp, 
 		int next_stop )
 {
-  int output_port = -1, i;
+  int output_port = -1;
 
   if(next_stop == msg->dest_terminal_id)
    {
-      output_port = NUM_ROUTER + GLOBAL_CHANNELS +(getTerminalID(msg->dest_terminal_id)%NUM_TERMINALS);
+      output_port = num_router + num_global_channel +(getTerminalID(msg->dest_terminal_id)%num_terminal);
     }
     else
     {
-     int intm_grp_id = next_stop / NUM_ROUTER;
+     int intm_grp_id = next_stop / num_router;
 
+     // a next stop in another group is always the far end of the global channel towards its group
      if(intm_grp_id != s->group_id)
       {
-        for(i=0; i<GLOBAL_CHANNELS; i++)
-         {
-           if(s->global_channel[i] == next_stop)
-             output_port = NUM_ROUTER + i;
-          }
+        output_port = s->route[intm_grp_id].output_port;
       }
       else
        {
-        output_port = next_stop % NUM_ROUTER;
+        output_port = next_stop % num_router;
        }
     }
     return output_port;
@@ -927,6 +1193,7 @@ router_packet_send( router_state * s,
 
    bf->c3 = 0;
    bf->c2 = 0;
+   bf->c4 = 0;
 
    next_stop = get_next_stop(s, bf, msg, lp, path);
    output_port = get_output_port(s, bf, msg, lp, next_stop); 
@@ -938,7 +1205,7 @@ router_packet_send( router_state * s,
    int buf_size = LOCAL_VC_SIZE;
 
    // Allocate output Virtual Channel
-  if(output_port >= NUM_ROUTER && output_port < NUM_ROUTER + GLOBAL_CHANNELS)
+  if(output_port >= num_router && output_port < num_router + num_global_channel)
   {
 	 //delay = GLOBAL_DELAY;
 	 //printf("\n Output port selected is %d ", output_port);
@@ -947,12 +1214,9 @@ router_packet_send( router_state * s,
 	 buf_size = GLOBAL_VC_SIZE;
   }
 
-  if(output_port >= NUM_ROUTER+GLOBAL_CHANNELS)
+  if(output_port >= num_router+num_global_channel)
 	buf_size = TERMINAL_VC_SIZE;
 
-/*   if(s->vc_occupancy[output_chan] >= ROUTER_THRESHOLD)
-            fprintf( dragonfly_event_log, " \n Dragonfly router buffer size %d router ID %d time stamp %lf ", s->vc_occupancy[output_chan], (int)lp->gid, tw_now(lp));
-*/
    if(s->vc_occupancy[output_chan] >= buf_size)
     {
        if(msg->last_hop == TERMINAL)
@@ -971,21 +1235,29 @@ router_packet_send( router_state * s,
        return;
     }
 
-#if DEBUG
-if( msg->packet_ID == TRACK && next_stop != msg->dest_terminal_id && msg->chunk_id == num_chunks-1)
-  {
-   printf("\n (%lf) [Router %d] Packet %lld being sent to intermediate group router %d Final destination router %d Output Channel Index %d Saved vc %d msg_intm_id %d \n", 
-              tw_now(lp), (int)lp->gid, msg->packet_ID, next_stop, 
-	      getRouterID(msg->dest_terminal_id), output_chan, msg->saved_vc, msg->intm_group_id);
-  }
-#endif
  // If source router doesn't have global channel and buffer space is available, then assign to appropriate intra-group virtual channel 
   msg->saved_available_time = s->next_output_available_time[output_port];
   ts = ((1/bandwidth) * CHUNK_SIZE) + tw_rand_exponential(lp->rng, (double)CHUNK_SIZE/200);
 
   s->next_output_available_time[output_port] = ROSS_MAX(s->next_output_available_time[output_port], tw_now(lp));
+
+  // Fast path (R_ARRIVE elision): a local hop to the next router that finds fewer than fast_path chunks in
+  // the channel buffer and queued for the link skips the R_ARRIVE of the next router. The chunk goes straight
+  // to the R_SEND of the next router after the link and receive delay. It still occupies the channel buffer
+  // until the credit the next router would have sent on its arrival, which this router schedules to itself,
+  // so only one of the three events of the hop is saved. The check only sees the sending router, the next
+  // router applies its own buffer check in R_SEND as usual.
+  if(fast_path && !global && next_stop != msg->dest_terminal_id
+     && s->vc_occupancy[output_chan] + (s->next_output_available_time[output_port] - tw_now(lp)) / ((1/bandwidth) * CHUNK_SIZE) < fast_path)
+     bf->c4 = 1;
+
   s->next_output_available_time[output_port] += ts;
-  e = tw_event_new(next_stop, s->next_output_available_time[output_port] - tw_now(lp), lp);
+  tw_stime delay = s->next_output_available_time[output_port] - tw_now(lp);
+
+  if(bf->c4)
+     delay += 0.1 + tw_rand_exponential(lp->rng, (double)MEAN_INTERVAL/200);
+
+  e = tw_event_new(next_stop, delay, lp);
 
   m = tw_event_data(e);
 
@@ -998,8 +1270,6 @@ if( msg->packet_ID == TRACK && next_stop != msg->dest_terminal_id && msg->chunk_
   msg->old_vc = output_chan;
   m->intm_lp_id = lp->gid;
 
-  s->vc_occupancy[output_chan]++;
-
   // Carry on the message information
   m->dest_terminal_id = msg->dest_terminal_id;
   m->packet_ID = msg->packet_ID;
@@ -1010,6 +1280,8 @@ if( msg->packet_ID == TRACK && next_stop != msg->dest_terminal_id && msg->chunk_
   m->wait_type = -1;
   m->chunk_id = msg->chunk_id;
 
+  s->vc_occupancy[output_chan]++;
+
 
   if(next_stop == msg->dest_terminal_id)
   {
@@ -1022,6 +1294,13 @@ if( msg->packet_ID == TRACK && next_stop != msg->dest_terminal_id && msg->chunk_
   {
     m->type = R_ARRIVE;
 
+   if(bf->c4)
+   {
+     // the hop router_packet_receive would have counted
+     m->my_N_hop++;
+     m->type = R_SEND;
+   }
+
    if( global )
    {
      if(s->vc_occupancy[output_chan] >= GLOBAL_VC_SIZE * num_chunks )
@@ -1034,6 +1313,20 @@ if( msg->packet_ID == TRACK && next_stop != msg->dest_terminal_id && msg->chunk_
     }
   }
   tw_event_send(e);
+
+  if(bf->c4)
+  {
+    // the credit of router_credit_send, leaving the next router as the chunk arrives there
+    int credit_delay = (1/LOCAL_BANDWIDTH) * CREDIT_SIZE;
+
+    e = tw_event_new(lp->gid, s->next_output_available_time[output_port] - tw_now(lp) + credit_delay, lp);
+    m = tw_event_data(e);
+    m->type = BUFFER;
+    m->vc_index = output_chan;
+    m->last_hop = LOCAL;
+    m->packet_ID = msg->packet_ID;
+    tw_event_send(e);
+  }
 }
 
 // Packet arrives at the router (can be an intermediate or final router)
@@ -1069,73 +1362,149 @@ router_packet_receive( router_state * s,
     m->type = R_SEND;
     m->wait_type = -1;
 
-#if DEBUG
-if(msg->packet_ID == TRACK && msg->chunk_id == num_chunks-1)
-	printf("\n Router %d packet received %lld source terminal id %d dest terminal ID %d ", (int)lp->gid, m->packet_ID, m->src_terminal_id/4, m->dest_terminal_id/4);
-#endif
     router_credit_send(s, bf, msg, lp);
     tw_event_send(e);  
 }
 /////////////////////////////////////////// Router related functions /////////////////////////////////
-void router_setup(router_state * r, tw_lp * lp)
+/* bytes of an arena slice, rounded up so that every array of a slice stays 8 byte aligned */
+size_t
+router_arena_bytes(size_t n)
 {
-   r->router_id=((int)lp->gid);
-   r->group_id=lp->gid/NUM_ROUTER;
+   return (n + 7) & ~(size_t)7;
+}
 
-   int i, j;
-   int offset=(lp->gid%NUM_ROUTER) * (GLOBAL_CHANNELS/2) +1;
-  
-//   r->next_credit_available_time = 0;
-   for(i=0; i < RADIX; i++)
+/* Allocates the arena of the nlp routers of this PE once the radix is known */
+void
+router_arena_init(int nlp)
+{
+   router_arena_stride = 2 * router_arena_bytes(radix * sizeof(tw_stime))
+	   + 2 * router_arena_bytes(radix * sizeof(struct waiting_packet *))
+	   + router_arena_bytes(num_groups * sizeof(struct group_route))
+	   + router_arena_bytes(radix * sizeof(int))
+	   + router_arena_bytes(radix * sizeof(unsigned int))
+	   + router_arena_bytes(num_global_channel * sizeof(int));
+
+   router_arena = tw_calloc(TW_LOC, "router arena", router_arena_stride, nlp);
+}
+
+/* Points the channel arrays of a router to its slice of the arena */
+void
+router_arena_carve(router_state * r, 
+		   tw_lp * lp)
+{
+   char * p = router_arena + lp->id * router_arena_stride;
+
+   r->next_output_available_time = (tw_stime *) p;
+   p += router_arena_bytes(radix * sizeof(tw_stime));
+   r->next_credit_available_time = (tw_stime *) p;
+   p += router_arena_bytes(radix * sizeof(tw_stime));
+   r->wait_head = (struct waiting_packet **) p;
+   p += router_arena_bytes(radix * sizeof(struct waiting_packet *));
+   r->wait_tail = (struct waiting_packet **) p;
+   p += router_arena_bytes(radix * sizeof(struct waiting_packet *));
+   r->route = (struct group_route *) p;
+   p += router_arena_bytes(num_groups * sizeof(struct group_route));
+   r->vc_occupancy = (int *) p;
+   p += router_arena_bytes(radix * sizeof(int));
+   r->output_vc_state = (unsigned int *) p;
+   p += router_arena_bytes(radix * sizeof(unsigned int));
+   r->global_channel = (int *) p;
+}
+
+/* Fills the route row of a router once its global channels are known */
+void
+router_route_setup(router_state * r, 
+		   tw_lp * lp)
+{
+   int g, i;
+   tw_lpid next_stop;
+
+   for(g = 0; g < num_groups; g++)
     {
-	//r->next_input_available_time[i]=0;
-	r->next_output_available_time[i]=0;
-        r->next_credit_available_time[i]=0;
+      if(g == r->group_id)
+       {
+	 r->route[g].next_stop = lp->gid;
+	 r->route[g].output_port = -1;
+	 continue;
+       }
 
-       // Set credit & router occupancy
-       r->vc_occupancy[i]=0;
+      // the router of this group holding the global channel to group g, or the far end of that channel
+      next_stop = getRouterFromGroupID(g, r);
+      if(next_stop == lp->gid)
+       {
+	 for(i = 0; i < num_global_channel; i++)
+	   if(r->global_channel[i]/num_router == g)
+	      next_stop = r->global_channel[i];
+       }
+      r->route[g].next_stop = next_stop;
 
-       // Set virtual channel state to idle
-       //r->input_vc_state[i] = VC_IDLE;
-       r->output_vc_state[i]= VC_IDLE;
+      r->route[g].output_port = -1;
+      if(next_stop/num_router == r->group_id)
+	 r->route[g].output_port = next_stop % num_router;
+      else
+       {
+	 for(i = 0; i < num_global_channel; i++)
+	   if(r->global_channel[i] == next_stop)
+	      r->route[g].output_port = num_router + i;
+       }
     }
+}
+
+/* Fills the routers at the far end of the global channels of router gid */
+void
+router_global_channels(tw_lpid gid,
+		       int * global_channel)
+{
+   int i;
+   int offset=(gid%num_router) * (num_global_channel/2) +1;
 
    //round the number of global channels to the nearest even number
-   for(i=0; i<GLOBAL_CHANNELS; i++)
+   for(i=0; i<num_global_channel; i++)
     {
       if(i%2!=0)
           {
-             r->global_channel[i]=(lp->gid + (offset*NUM_ROUTER))%total_routers;
+             global_channel[i]=(gid + (offset*num_router))%total_routers;
              offset++;
           }
           else
            {
-             r->global_channel[i]=lp->gid-((offset)*NUM_ROUTER);
+             global_channel[i]=gid-((offset)*num_router);
            }
-        if(r->global_channel[i]<0)
+        if(global_channel[i]<0)
          {
-           r->global_channel[i]=total_routers+r->global_channel[i]; 
+           global_channel[i]=total_routers+global_channel[i]; 
 	 }
-   
-  #if PRINT_ROUTER_TABLE
-	//fprintf(dragonfly_event_log, "\n Router %d setup ", lp->gid);
+    }
+}
+
+void router_setup(router_state * r, tw_lp * lp)
+{
+   r->router_id=((int)lp->gid);
+   r->group_id=lp->gid/num_router;
+   router_arena_carve(r, lp);
+
+   int i;
+  
+//   r->next_credit_available_time = 0;
+   for(i=0; i < radix; i++)
+    {
+	//r->next_input_available_time[i]=0;
+	r->next_output_available_time[i]=0;
+        r->next_credit_available_time[i]=0;
+
+       // Set credit & router occupancy
+       r->vc_occupancy[i]=0;
 
+       // Set virtual channel state to idle
+       //r->input_vc_state[i] = VC_IDLE;
+       r->output_vc_state[i]= VC_IDLE;
 
-	//fprintf(dragonfly_event_log, "\n Router %d connected to Router %d Group %d to Group %d ", local_router_id, r->global_channel[i], r->group_id, (r->global_channel[i]/NUM_ROUTER));
-   #endif
+       r->wait_head[i] = NULL;
+       r->wait_tail[i] = NULL;
     }
-  r->waiting_list = tw_calloc(TW_LOC, "waiting list", sizeof(struct waiting_packet), ROUTER_WAITING_PACK_COUNT);
 
-  for (j = 0; j < ROUTER_WAITING_PACK_COUNT - 1; j++) {
-     r->waiting_list[j].next = &r->waiting_list[j + 1];
-     // 16-05
-     r->waiting_list[j].packet = NULL;
-     r->waiting_list[j].chan = -1;
-  }
-  
-  r->waiting_list[j].next = NULL;
-  r->waiting_list[j].chan = -1;
-  r->head = &r->waiting_list[0];
+  router_global_channels(lp->gid, r->global_channel);
+  router_route_setup(r, lp);
   r->wait_count = 0;
 }	
 /*If a packet arrives at a router and the channel is not available, the router maintains a list of waiting packets and the respective channels
@@ -1147,9 +1516,9 @@ update_router_waiting_list( router_state * s,
                         tw_lp * lp )
 {
    bf->c3 = 0;
-   int loc = s->wait_count, chan;
+   int chan;
    
-   if(loc >= ROUTER_WAITING_PACK_COUNT)
+   if(s->wait_count >= ROUTER_WAITING_PACK_COUNT)
     {
 //       In the unusual case where all waiting packets are full, the packets will be dropped
 //       printf(" Reached maximum count of linked list %d ", s->wait_count);
@@ -1165,29 +1534,11 @@ update_router_waiting_list( router_state * s,
 //          else
 //  	      printf("\n ---- Invalid wait type in the queue %d ", msg->wait_type);
 
-   s->waiting_list[loc].chan = chan;
-   s->waiting_list[loc].packet = msg;
-   
+   waiting_packet_push_tail(&s->wait_head[chan], &s->wait_tail[chan], msg);
    s->wait_count++;
 }
 
-void 
-waiting_router_packet_free(router_state * s, int loc)
-{
-  int i, max_count = s->wait_count -1;
-
-  for(i = loc; i < max_count; i++) {
-       s->waiting_list[i].chan = s->waiting_list[i + 1].chan;
-       s->waiting_list[i].packet = s->waiting_list[i + 1].packet;
-  }
-  s->waiting_list[max_count].packet = NULL;
-  s->waiting_list[max_count].chan = -1;
-
-  s->wait_count--;
-}
-
-
-/*Whenever an input or output channel is set to idle, the reschedule event is triggered to send the next packet */
+/*Whenever an output channel gets a credit, the oldest packet waiting on it is rescheduled */
 void
 schedule_router_waiting_msg( router_state * s,
                            tw_bf * bf,
@@ -1196,40 +1547,29 @@ schedule_router_waiting_msg( router_state * s,
 			   int chan)
 {
   bf->c3 = 0;
-  if( s->wait_count <= 0 )
+  msg->wait_rec = NULL;
+  if( !s->wait_head[chan] )
    {
     return;
    }
 
-  int loc=s->wait_count;
   tw_event * e_h;
   terminal_message * m;
   tw_stime ts;
-  int j;
+  waiting_packet * w = waiting_packet_pop_head(&s->wait_head[chan], &s->wait_tail[chan]);
 
- for(j = 0; j < loc; j++)
-  {
-    if( s->waiting_list[j].chan == chan )
-     {
-       // 16-05
-       bf->c3 = 1;
-       ts = tw_rand_exponential(lp->rng, MEAN_INTERVAL/1000);	
-       e_h = tw_event_new( lp->gid, ts, lp );
-       m = tw_event_data( e_h );
-       memcpy(m, s->waiting_list[j].packet, sizeof(terminal_message));
+  bf->c3 = 1;
+  s->wait_count--;
+  msg->wait_rec = w;
 
-       //        For reverse computation, also copy data to the msg
-       memcpy(msg, s->waiting_list[j].packet, sizeof(terminal_message));                 
-       msg->wait_loc = loc;
+  ts = tw_rand_exponential(lp->rng, MEAN_INTERVAL/1000);	
+  e_h = tw_event_new( lp->gid, ts, lp );
+  m = tw_event_data( e_h );
+  waiting_packet_load(w, m);
 
 //       changed from R_ARRIVE to R_SEND 16-05
-       m->type = R_SEND;
-       msg->type = BUFFER;
-       tw_event_send(e_h);       
-       waiting_router_packet_free(s, loc);
-       break;
-     }
-  }
+  m->type = R_SEND;
+  tw_event_send(e_h);       
 }
 /* When a credit arrives, the router channel is updated */
 void router_buf_update(router_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
@@ -1245,6 +1585,7 @@ void router_buf_update(router_state * s, tw_bf * bf, terminal_message * msg, tw_
 void router_event(router_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
 {
   *(int *)bf = (int)0;
+  msg->event_time = tw_now(lp);
   switch(msg->type)
    {
 	   case R_SEND: // Router has sent a packet to an intra-group router (local channel)
@@ -1274,8 +1615,6 @@ void router_event(router_state * s, tw_bf * bf, terminal_message * msg, tw_lp *
 //Reverse computation handler for a terminal event
 void terminal_rc_event_handler(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
 {
-   int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
-
    switch(msg->type)
    {
 	   case T_GENERATE:
@@ -1290,8 +1629,6 @@ void terminal_rc_event_handler(terminal_state * s, tw_bf * bf, terminal_message
 	         {
 		   if(bf->c3) 
 		    {
-			int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
-			N_generated_storage[index]--;	
 		        s->packet_counter--;
 		    }
 	           s->terminal_available_time = msg->saved_available_time;
@@ -1315,10 +1652,9 @@ void terminal_rc_event_handler(terminal_state * s, tw_bf * bf, terminal_message
 		{
 		   if(bf->c3)
 			return;
-		     s->wait_count-=1;
-		     int loc = s->wait_count; 
-		     s->waiting_list[loc].chan = -1;
-		     s->waiting_list[loc].packet = NULL;
+		   // the packet queued by this event is still the tail of its channel FIFO
+		   s->wait_count-=1;
+		   waiting_packet_pop_tail(&s->wait_head[msg->saved_vc], &s->wait_tail[msg->saved_vc]);
 		}
 	   break;
 
@@ -1336,34 +1672,18 @@ void terminal_rc_event_handler(terminal_state * s, tw_bf * bf, terminal_message
 		   
 		   if(bf->c3)
 		    {
+			   // put the released packet back at the head of its channel FIFO
     		           tw_rand_reverse_unif(lp->rng);
-			   int loc = msg->wait_loc, i;
-			   if(msg->wait_loc < 0)
-			      printf("\n Invalid message wait loc %d ", msg->wait_loc);
-			   int max_count = s->wait_count;
-	                   for(i = max_count; i > loc ; i--)
-        	            {
-               		         s->waiting_list[i].chan = s->waiting_list[i-1].chan;
-                        	 s->waiting_list[i].packet = s->waiting_list[i-1].packet;
-	                    }
-        	          s->waiting_list[loc].chan = msg->saved_vc;
-                	  s->waiting_list[loc].packet = msg;
-                          s->wait_count++;	
+			   waiting_packet_push_head(&s->wait_head[msg_indx], &s->wait_tail[msg_indx], msg->wait_rec);
+                           s->wait_count++;	
+			   msg->wait_rec = NULL;
 		  }
 	     }  
 	   break;
-	
-	  case FINISH:
-		{
-		    N_finished--;
-		    int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
-		    N_finished_storage[index]--;
-		    total_time -= (tw_now(lp) - msg->travel_start_time);
-		    total_hops -= msg->my_N_hop;
-		    if(bf->c3)
-		         max_latency = msg->saved_available_time;
-                    
-		}
+
+	   case FINISH:
+		// the latency of a finished packet is recorded at commit, nothing to undo
+	   break;
    }
 }
 //Reverse computation handler for a router event
@@ -1385,6 +1705,10 @@ void router_rc_event_handler(router_state * s, tw_bf * bf, terminal_message * ms
 			int output_port = output_chan/NUM_VC;
 
 			s->next_output_available_time[output_port] = msg->saved_available_time;
+
+			// a fast path chunk drew its receive delay here
+			if(bf->c4)
+			   tw_rand_reverse_unif(lp->rng);
 			s->vc_occupancy[output_chan]--;
 			s->output_vc_state[output_chan]=VC_IDLE;
 			if(bf->c2)
@@ -1419,20 +1743,11 @@ void router_rc_event_handler(router_state * s, tw_bf * bf, terminal_message * ms
 
                       if(bf->c3)
                        {
-                         int loc = msg->wait_loc, i;
+			 // put the released packet back at the head of its channel FIFO
 			 tw_rand_reverse_unif(lp->rng);
-			 if(msg->wait_loc < 0)
-				printf("\n Invalid message wait loc %d ", msg->wait_loc);
-                         int max_count = s->wait_count;
-                          for(i = max_count; i > loc ; i--)
-                          {
-                            s->waiting_list[i].chan = s->waiting_list[i-1].chan;
-                            s->waiting_list[i].packet = s->waiting_list[i-1].packet;
-                          }
-//			  changed from saved_vc to vc_index 16-05
-                          s->waiting_list[loc].chan = msg->vc_index;
-                          s->waiting_list[loc].packet = msg;
-                          s->wait_count=s->wait_count+1;
+                         waiting_packet_push_head(&s->wait_head[msg_indx], &s->wait_tail[msg_indx], msg->wait_rec);
+                         s->wait_count=s->wait_count+1;
+			 msg->wait_rec = NULL;
                        }
 		   }
 	    break;
@@ -1441,11 +1756,9 @@ void router_rc_event_handler(router_state * s, tw_bf * bf, terminal_message * ms
 		  {
 			if(bf->c3)
 			   return;
+			// the packet queued by this event is still the tail of its channel FIFO
 			s->wait_count-=1;
-			int loc = s->wait_count;
-			// 16-05
-			s->waiting_list[loc].chan = -1;
-			s->waiting_list[loc].packet = NULL;
+			waiting_packet_pop_tail(&s->wait_head[msg->vc_index], &s->wait_tail[msg->vc_index]);
 		  }
     }
 }
@@ -1484,6 +1797,76 @@ void mpi_rc_event_handler(process_state * s, tw_bf * bf, terminal_message * msg,
 	   break;
 	}
 }
+/////////////////////////////////////////// COMMIT HANDLERS ///////////////////////////////////
+// channel an event works on for the event trace, -1 when it has none
+int
+trace_port(tw_bf * bf,
+	   terminal_message * msg)
+{
+  switch(msg->type)
+   {
+     case T_SEND:
+     case T_ARRIVE:
+     case R_ARRIVE:
+	return msg->saved_vc;
+
+     case R_SEND:
+	// a packet that found its channel full went back to wait for vc_index
+	return bf->c3 ? msg->vc_index : msg->old_vc;
+
+     case BUFFER:
+	return msg->vc_index;
+
+     default:
+	return -1;
+   }
+}
+
+// A waiting packet released by a credit can no longer be rolled back, its record goes back to the slab.
+// Committed events are written to the event trace and counted in the statistics, rolled back ones never get here.
+void terminal_commit_handler(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{
+  // the last chunk of a packet leaving its source terminal
+  if(msg->type == T_SEND && bf->c3)
+     dragonfly_stats_generated(msg->event_time);
+
+  if(msg->type == FINISH)
+     dragonfly_stats_finished(msg->event_time, msg->event_time - msg->travel_start_time, msg->my_N_hop);
+
+  if(event_trace[0])
+     dragonfly_trace_record_event(msg->event_time, lp->gid, msg->type, msg->packet_ID,
+				  msg->type == WAIT ? msg->saved_vc : trace_port(bf, msg));
+
+  if(msg->type == BUFFER && bf->c3 && msg->wait_rec)
+   {
+     waiting_packet_release(msg->wait_rec);
+     msg->wait_rec = NULL;
+   }
+}
+
+void router_commit_handler(router_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{
+  // a chunk that left the router, not one that went back to wait for buffer space
+  if(msg->type == R_SEND && !bf->c3)
+     dragonfly_stats_router_send(bf->c4);
+
+  if(event_trace[0])
+     dragonfly_trace_record_event(msg->event_time, lp->gid, msg->type, msg->packet_ID,
+				  msg->type == WAIT ? msg->vc_index : trace_port(bf, msg));
+
+  if(msg->type == BUFFER && bf->c3 && msg->wait_rec)
+   {
+     waiting_packet_release(msg->wait_rec);
+     msg->wait_rec = NULL;
+   }
+}
+
+// MPI_SEND events carry no packet
+void mpi_commit_handler(process_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{
+  if(event_trace[0])
+     dragonfly_trace_record_event(msg->event_time, lp->gid, msg->type, 0, -1);
+}
 ////////////////////////////////////////////////////// MAIN ///////////////////////////////////////////////////////
 ////////////////////////////////////////////////////// LP TYPES /////////////////////////////////////////////////
 tw_lptype dragonfly_lps[] =
@@ -1494,6 +1877,7 @@ tw_lptype dragonfly_lps[] =
     (pre_run_f) NULL,
     (event_f) terminal_event,
     (revent_f) terminal_rc_event_handler,
+    (commit_f) terminal_commit_handler,
     (final_f) final,
     (map_f) mapping,
     sizeof(terminal_state)
@@ -1503,6 +1887,7 @@ tw_lptype dragonfly_lps[] =
      (pre_run_f) NULL,
      (event_f) router_event,
      (revent_f) router_rc_event_handler,
+     (commit_f) router_commit_handler,
      (final_f) final,
      (map_f) mapping,
      sizeof(router_state),
@@ -1512,6 +1897,7 @@ tw_lptype dragonfly_lps[] =
      (pre_run_f) NULL,
      (event_f) mpi_event,
      (revent_f) mpi_rc_event_handler,
+     (commit_f) mpi_commit_handler,
      (final_f) final,
      (map_f) mapping,
      sizeof(process_state),
@@ -1519,28 +1905,110 @@ tw_lptype dragonfly_lps[] =
    {0},
 };
 
+//////////////////////////////////////////// PROFILING ////////////////////////////////////////
+// With --profile=1 main swaps these in for the handlers of dragonfly_lps, every call is timed and
+// counted under its LP class and event type. The type is read before the call, handlers may reuse msg.
+static const char * profile_event_names[] =
+{
+  "RESCHEDULE", "T_GENERATE", "T_ARRIVE", "T_SEND", "R_SEND", "R_ARRIVE",
+  "BUFFER", "WAIT", "FINISH", "MPI_SEND", "MPI_RECV"
+};
+
+void profile_forward(int lp_class, event_f handler, void * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{
+  int type = msg->type;
+  tw_clock start = tw_clock_read();
+
+  handler(s, bf, msg, lp);
+  dragonfly_profile_forward(lp_class, type, tw_clock_read() - start);
+}
+
+void profile_reverse(int lp_class, revent_f handler, void * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{
+  int type = msg->type;
+  tw_clock start = tw_clock_read();
+
+  handler(s, bf, msg, lp);
+  dragonfly_profile_reverse(lp_class, type, tw_clock_read() - start);
+}
+
+void profile_commit(int lp_class, commit_f handler, void * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{
+  dragonfly_profile_commit(lp_class, msg->type);
+  handler(s, bf, msg, lp);
+}
+
+void terminal_event_profiled(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_forward(PROFILE_TERMINAL, (event_f) terminal_event, s, bf, msg, lp); }
+void terminal_rc_profiled(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_reverse(PROFILE_TERMINAL, (revent_f) terminal_rc_event_handler, s, bf, msg, lp); }
+void terminal_commit_profiled(terminal_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_commit(PROFILE_TERMINAL, (commit_f) terminal_commit_handler, s, bf, msg, lp); }
+
+void router_event_profiled(router_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_forward(PROFILE_ROUTER, (event_f) router_event, s, bf, msg, lp); }
+void router_rc_profiled(router_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_reverse(PROFILE_ROUTER, (revent_f) router_rc_event_handler, s, bf, msg, lp); }
+void router_commit_profiled(router_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_commit(PROFILE_ROUTER, (commit_f) router_commit_handler, s, bf, msg, lp); }
+
+void mpi_event_profiled(process_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_forward(PROFILE_MPI, (event_f) mpi_event, s, bf, msg, lp); }
+void mpi_rc_profiled(process_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_reverse(PROFILE_MPI, (revent_f) mpi_rc_event_handler, s, bf, msg, lp); }
+void mpi_commit_profiled(process_state * s, tw_bf * bf, terminal_message * msg, tw_lp * lp)
+{ profile_commit(PROFILE_MPI, (commit_f) mpi_commit_handler, s, bf, msg, lp); }
+
+// dragonfly_lps entries are terminal, router, MPI process
+void profile_install(void)
+{
+  dragonfly_lps[0].event = (event_f) terminal_event_profiled;
+  dragonfly_lps[0].revent = (revent_f) terminal_rc_profiled;
+  dragonfly_lps[0].commit = (commit_f) terminal_commit_profiled;
+
+  dragonfly_lps[1].event = (event_f) router_event_profiled;
+  dragonfly_lps[1].revent = (revent_f) router_rc_profiled;
+  dragonfly_lps[1].commit = (commit_f) router_commit_profiled;
+
+  dragonfly_lps[2].event = (event_f) mpi_event_profiled;
+  dragonfly_lps[2].revent = (revent_f) mpi_rc_profiled;
+  dragonfly_lps[2].commit = (commit_f) mpi_commit_profiled;
+}
+
 const tw_optdef app_opt [] =
 {
    TWOPT_GROUP("Dragonfly Model"),
    TWOPT_UINT("memory", opt_mem, "optimistic memory"),
-   TWOPT_UINT("traffic", traffic, "UNIFORM RANDOM=1, DRAGONFLY ZONES=2, TRANSPOSE=3, NEAREST NEIGHBOR=4 "),
+   TWOPT_UINT("traffic", traffic, "UNIFORM RANDOM=1, WORST CASE=2, TRANSPOSE=3, NEAREST NEIGHBOR=4, BISECTION=5, NEAREST ROUTER=6"),
+   TWOPT_CHAR("traffic_file", traffic_file, "destination terminal of every MPI process (-1 sends nothing), replaces --traffic"),
    TWOPT_UINT("routing", ROUTING, "MINIMAL=0, NON_MINIMAL=1, ADAPTIVE=2(ADAPTIVE ROUTING QUEUE CONGESTION SENSING FEATURE's DEVELOPMENT IN PROGRESS)"),
    TWOPT_UINT("mem_factor", mem_factor, "mem_factor"),
    TWOPT_STIME("arrive_rate", MEAN_INTERVAL, "packet inter-arrival rate"),
+   TWOPT_UINT("routers", num_router, "number of routers in a group"),
+   TWOPT_UINT("terminals", num_terminal, "number of terminals attached to a router"),
+   TWOPT_UINT("global_channels", num_global_channel, "number of global channels of a router (even)"),
+   TWOPT_CHAR("event_trace", event_trace, "write every committed event to the binary trace PREFIX.<rank>"),
+   TWOPT_CHAR("mapping", mapping_str, "linear (LP ranges of each type split over PEs) or group (whole groups per PE and KP)"),
+   TWOPT_STIME("latency_bin", latency_bin, "width of the latency histogram bins in ns"),
+   TWOPT_UINT("fast_path", fast_path, "R_ARRIVE elision: local hops finding fewer chunks than this in the channel go straight to the next router's R_SEND, 0 = off"),
+   TWOPT_UINT("profile", handler_profile, "count and time the handlers per LP class and event type, report rollback ratios"),
    TWOPT_END()
 };
 
 tw_lp * dragonfly_mapping_to_lp(tw_lpid lpid)
 {
   int index;
+  tw_lpid router_begin, terminal_begin, mpi_begin;
+
+  local_lp_begin(&router_begin, &terminal_begin, &mpi_begin);
 
   if(lpid < total_routers)
-      index = lpid - g_tw_mynode * nlp_router_per_pe - get_router_rem();
+      index = lpid - router_begin;
   else 
      if(lpid >= total_routers && lpid < total_routers+total_terminals)
-        index = nlp_router_per_pe + (lpid - g_tw_mynode * nlp_terminal_per_pe - get_terminal_rem() - total_routers);
+        index = nlp_router_per_pe + (lpid - terminal_begin);
    else
-	 index = nlp_router_per_pe + nlp_terminal_per_pe + (lpid - g_tw_mynode * nlp_mpi_procs_per_pe - get_terminal_rem() - total_routers - total_terminals);	
+	 index = nlp_router_per_pe + nlp_terminal_per_pe + (lpid - mpi_begin);	
 
   return g_tw_lp[index];
 }
@@ -1555,17 +2023,27 @@ void dragonfly_mapping(void)
     tw_kp_onpe(kpid, g_tw_pe[0]);
 
   int i;
+  tw_lpid router_begin, terminal_begin, mpi_begin;
+  // LPs per KP block, with the group mapping every group (routers, terminals, MPI processes) is on one KP
+  int kp_routers = 1, kp_nodes = 1;
+
+  local_lp_begin(&router_begin, &terminal_begin, &mpi_begin);
+  if(group_mapping)
+   {
+     kp_routers = num_router;
+     kp_nodes = num_router * num_terminal;
+   }
   //printf("\n Node %d router start %d Terminal start %d MPI procs start %d ", g_tw_mynode, 
 //									    g_tw_mynode * nlp_router_per_pe + get_router_rem(), 
 //									    total_routers + g_tw_mynode * nlp_terminal_per_pe + get_terminal_rem(), 
 //									    total_routers + total_terminals + g_tw_mynode * nlp_mpi_procs_per_pe);
   for(i = 0; i < nlp_router_per_pe; i++)
    {
-     kpid = i % g_tw_nkp;
+     kpid = (i / kp_routers) % g_tw_nkp;
 
      pe = tw_getpe(kpid % g_tw_npe);
      
-     tw_lp_onpe(i, pe, g_tw_mynode * nlp_router_per_pe + i + get_router_rem());
+     tw_lp_onpe(i, pe, router_begin + i);
      tw_lp_onkp(g_tw_lp[i], g_tw_kp[kpid]);
      tw_lp_settype(i, &dragonfly_lps[1]);
 
@@ -1576,11 +2054,11 @@ void dragonfly_mapping(void)
 //apping for terminal LP
   for(i = 0; i < nlp_terminal_per_pe; i++)
    {
-      kpid = i % g_tw_nkp;
+      kpid = (i / kp_nodes) % g_tw_nkp;
 
       pe = tw_getpe(kpid % g_tw_npe);
 
-      tw_lp_onpe(nlp_router_per_pe + i, pe, total_routers + g_tw_mynode * nlp_terminal_per_pe + i + get_terminal_rem());
+      tw_lp_onpe(nlp_router_per_pe + i, pe, terminal_begin + i);
       tw_lp_onkp(g_tw_lp[nlp_router_per_pe + i], g_tw_kp[kpid]);
       tw_lp_settype(nlp_router_per_pe + i, &dragonfly_lps[0]);
 
@@ -1591,11 +2069,11 @@ void dragonfly_mapping(void)
 // mapping for MPI process LP
   for(i = 0; i < nlp_mpi_procs_per_pe; i++)
    {
-      kpid = i % g_tw_nkp;
+      kpid = (i / kp_nodes) % g_tw_nkp;
 
       pe = tw_getpe(kpid % g_tw_npe);
 
-      tw_lp_onpe(nlp_router_per_pe + nlp_terminal_per_pe + i, pe, total_routers + total_terminals + g_tw_mynode * nlp_mpi_procs_per_pe + i + get_terminal_rem());
+      tw_lp_onpe(nlp_router_per_pe + nlp_terminal_per_pe + i, pe, mpi_begin + i);
       tw_lp_onkp(g_tw_lp[nlp_router_per_pe + nlp_terminal_per_pe + i], g_tw_kp[kpid]);
       tw_lp_settype(nlp_router_per_pe + nlp_terminal_per_pe + i, &dragonfly_lps[2]);
 
@@ -1607,7 +2085,6 @@ void dragonfly_mapping(void)
 
 int main(int argc, char **argv)
 {
-     char log[32];
      tw_opt_add(app_opt);
      tw_init(&argc, &argv);
 
@@ -1616,13 +2093,24 @@ int main(int argc, char **argv)
      // TRANSPOSE (send packets to the transpose of a 2D matrix)
      minimal_count = 0;
      nonmin_count = 0;
+
+     // global channels are handed out in pairs, one to a lower and one to a higher group
+     if(num_router < 1 || num_terminal < 1 || num_global_channel < 2 || num_global_channel % 2)
+	tw_error(TW_LOC, "\n Invalid dragonfly %d routers %d terminals %d global channels, the number of global channels must be even ",
+		 num_router, num_terminal, num_global_channel);
+
+     if(!traffic_file[0] && (traffic < UNIFORM_RANDOM || traffic > NEAREST_ROUTER))
+	tw_error(TW_LOC, "\n Unknown traffic pattern %d ", traffic);
+
+     radix = NUM_VC * (num_router + num_global_channel + num_terminal);
+     num_groups = num_router * num_global_channel + 1;
      num_packets = MESSAGE_SIZE / PACKET_SIZE;
      num_chunks = PACKET_SIZE / CHUNK_SIZE;
      max_packets = INJECTION_INTERVAL / MEAN_INTERVAL;
 
-     total_routers=NUM_ROUTER*num_groups;
-     total_terminals=NUM_ROUTER*NUM_TERMINALS*num_groups;
-     total_mpi_procs = NUM_ROUTER*NUM_TERMINALS*num_groups;
+     total_routers=num_router*num_groups;
+     total_terminals=num_router*num_terminal*num_groups;
+     total_mpi_procs = num_router*num_terminal*num_groups;
 
 //    Assume a one-to-one mapping of MPI processes to terminals/nodes
      nlp_terminal_per_pe = total_terminals/tw_nnodes()/g_tw_npe;
@@ -1630,12 +2118,6 @@ int main(int argc, char **argv)
 
      terminal_rem = total_terminals % (tw_nnodes()/g_tw_npe);
 
-#ifdef LOG_DRAGONFLY
-     sprintf( log, "dragonfly-log.%d", g_tw_mynode );
-     dragonfly_event_log = fopen( log, "w+");
-     if( dragonfly_event_log == NULL )
-        tw_error( TW_LOC, "Failed to Open DRAGONFLY Event Log file \n");
-#endif
      if(g_tw_mynode < terminal_rem)
      {
        nlp_terminal_per_pe++;
@@ -1649,8 +2131,32 @@ int main(int argc, char **argv)
       if(g_tw_mynode < router_rem)
         nlp_router_per_pe++;
 
+     if(strcmp(mapping_str, "group") == 0)
+      {
+	// whole groups per rank, only global channel hops cross ranks
+	group_mapping = 1;
+	if(num_groups < tw_nnodes())
+	   tw_error(TW_LOC, "\n Group mapping needs at least one group per rank, %d groups on %d ranks ", (int)num_groups, (int)tw_nnodes());
+
+	int groups = split_first(g_tw_mynode + 1, num_groups, tw_nnodes()) - split_first(g_tw_mynode, num_groups, tw_nnodes());
+
+	nlp_router_per_pe = groups * num_router;
+	nlp_terminal_per_pe = groups * num_router * num_terminal;
+	nlp_mpi_procs_per_pe = nlp_terminal_per_pe;
+      }
+     else if(strcmp(mapping_str, "linear") != 0)
+	printf("\n Incorrect mapping specified, using linear mapping ");
+
      range_start=nlp_router_per_pe + nlp_terminal_per_pe + nlp_mpi_procs_per_pe;
 
+     // channel arrays and routing tables of the routers of this PE, filled in by router_setup
+     router_arena_init(nlp_router_per_pe);
+
+     // destination of every MPI process of this PE
+     if(traffic_file[0])
+	traffic = TRAFFIC_FILE;
+     traffic_setup(nlp_mpi_procs_per_pe);
+
      g_tw_mapping=CUSTOM;
      g_tw_custom_initial_mapping=&dragonfly_mapping;
      g_tw_custom_lp_global_to_local_map=&dragonfly_mapping_to_lp;
@@ -1659,13 +2165,6 @@ int main(int argc, char **argv)
      tw_define_lps(range_start, sizeof(terminal_message));
 
    
-#if DEBUG
-     //sprintf( log, "dragonfly-log.%d", g_tw_mynode );
-     //dragonfly_event_log=fopen(log, "w+");
-
-     //if(dragonfly_event_log == NULL)
-	//tw_error(TW_LOC, "\n Failed to open dragonfly event log file \n");
-#endif
 
 
 #if DEBUG
@@ -1676,9 +2175,26 @@ int main(int argc, char **argv)
 	  printf("\n Arrival rate %f g_tw_mynode %d total %d nlp_terminal_per_pe is %d, nlp_router_per_pe is %d \n ", MEAN_INTERVAL, (int)g_tw_mynode, range_start, nlp_terminal_per_pe, nlp_router_per_pe);
 	}
 #endif
+    if(group_mapping && tw_ismaster())
+     {
+	printf("\nGroup mapping: %d groups on %d ranks \n", (int)num_groups, (int)tw_nnodes());
+	printf("Predicted fraction of remote hop events: group mapping %lf linear mapping %lf \n",
+	       remote_link_fraction(1), remote_link_fraction(0));
+     }
     packet_offset = (g_tw_ts_end/MEAN_INTERVAL) * num_packets;
+
+    dragonfly_stats_init(N_COLLECT_POINTS, g_tw_ts_end, latency_bin);
+
+    if(event_trace[0])
+       dragonfly_trace_open(event_trace, g_tw_mynode);
+
+    if(handler_profile)
+       profile_install();
+
     tw_run();
 
+    dragonfly_trace_close();
+
     if(tw_ismaster())
     {
       printf("\nDragonfly Network Model Statistics \n");
@@ -1688,81 +2204,44 @@ int main(int argc, char **argv)
 	      printf("\n ADAPTIVE ROUTING STATS: %d packets routed minimally %d packets routed non-minimally ", minimal_count, nonmin_count);
     }
 
-    unsigned long long total_finished_storage[N_COLLECT_POINTS];
-    unsigned long long total_generated_storage[N_COLLECT_POINTS];
-    unsigned long long N_total_finish,N_total_hop;
-
-   tw_stime total_time_sum,g_max_latency;
-
-   int i;
-
-   for( i=0; i<N_COLLECT_POINTS; i++ )
-    {
-     MPI_Reduce( &N_finished_storage[i], &total_finished_storage[i],1,
-                 MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-   
-     MPI_Reduce( &N_generated_storage[i], &total_generated_storage[i],1,
-                  MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-     }
-     MPI_Reduce( &total_time, &total_time_sum,1,
-                    MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-   
-     MPI_Reduce( &N_finished, &N_total_finish,1,
-                    MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-   
-     MPI_Reduce( &total_hops, &N_total_hop,1,
-                    MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-   
-     MPI_Reduce( &max_latency, &g_max_latency,1,
-                    MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+   // generated and finished series, hop and latency sums, latency histogram and max latency in one reduction
+   dragonfly_stats * total = dragonfly_stats_reduce();
 
-    for( i=1; i<N_COLLECT_POINTS; i++ )
-       {
-         total_finished_storage[i]+=total_finished_storage[i-1];
-         total_generated_storage[i]+=total_generated_storage[i-1];
-       }
-   
      if(tw_ismaster())
       {
+           unsigned long long total_finished = 0, total_generated = 0;
+           int i;
+
+           for( i=0; i<N_COLLECT_POINTS; i++ )
+            {
+              total_finished += total->finished[i];
+              total_generated += total->generated[i];
+            }
+
            printf("\n ****************** \n");
            printf("\n total finish:         %lld and %lld; \n",
-                   total_finished_storage[N_COLLECT_POINTS-1],N_total_finish);
+                   total_finished, (unsigned long long)total->n_finished);
            printf("\n total generate:       %lld; \n",
-                  total_generated_storage[N_COLLECT_POINTS-1]);
+                  total_generated);
            printf("\n total hops:           %lf; \n",
-                   (double)N_total_hop/total_finished_storage[N_COLLECT_POINTS-1]);
-           printf("\n average travel time:  %lf; \n\n",
-                   total_time_sum/total_finished_storage[N_COLLECT_POINTS-1]);
-
-/*          for( i=0; i<N_COLLECT_POINTS; i++ )
-           {
-             printf(" %d ",i*100/N_COLLECT_POINTS);
-             printf("finish: %lld; generate: %lld; alive: %lld\n",
-                     total_finished_storage[i],
-                     total_generated_storage[i],
-                     total_generated_storage[i]-total_finished_storage[i]);
-           }
-
-	tw_stime bandwidth;
-	tw_stime interval = (g_tw_ts_end / N_COLLECT_POINTS);
-	interval = interval / (1000.0 * 1000.0 * 1000.0); //convert seconds to ns
-	for( i=1; i<N_COLLECT_POINTS; i++ )
-	   {
-		bandwidth = total_finished_storage[i] - total_finished_storage[i - 1];
-		bandwidth = (bandwidth * PACKET_SIZE) / (1024.0 * 1024.0 * 1024.0);
-		bandwidth = bandwidth / interval;
-		printf("\n Interval %.7lf Bandwidth %lf ", interval, bandwidth);
-	   }
-            // capture the steady state statistics
-          unsigned long long steady_sum=0;
-          for( i = N_COLLECT_POINTS/2; i<N_COLLECT_POINTS;i++)
-             steady_sum+=total_generated_storage[i]-total_finished_storage[i];
-        
-          printf("\n Steady state, packet alive: %lld\n",
-                   2*steady_sum/N_COLLECT_POINTS);*/
-          printf("\nMax latency is %lf\n\n",g_max_latency);
+                   total->hops/total_finished);
+           printf("\n average travel time:  %lf; \n",
+                   total->latency_sum/total_finished);
+           printf("\n latency percentiles: ");
+           dragonfly_stats_print_percentile("50th", total, 0.50);
+           dragonfly_stats_print_percentile("90th", total, 0.90);
+           dragonfly_stats_print_percentile("99th", total, 0.99);
+           dragonfly_stats_print_percentile("99.9th", total, 0.999);
+           printf("; \n\n");
+           printf("\nMax latency is %lf\n\n",total->max_latency);
+           if(fast_path)
+              printf("Fast path: %.0lf of %.0lf chunks sent by routers skipped the R_ARRIVE event \n\n",
+                     total->fast_hops, total->router_sends);
 
       }
+   if(handler_profile)
+      dragonfly_profile_report(profile_event_names, sizeof(profile_event_names) / sizeof(profile_event_names[0]));
+
    tw_end();
    return 0;
 }
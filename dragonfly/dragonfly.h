@@ -3,10 +3,7 @@
 
 #include <ross.h>
 
-// dragonfly basic configuration parameters
-#define GLOBAL_CHANNELS 4
-#define NUM_ROUTER 8
-#define NUM_TERMINALS 4
+// dragonfly basic configuration parameters are set at run time, see num_router below
 
 #define MESSAGE_SIZE 512.0
 #define PACKET_SIZE 512.0
@@ -37,20 +34,14 @@
 #define GLOBAL_VC_SIZE 65536
 #define TERMINAL_VC_SIZE 16384
 
-// radix of each router
-#define RADIX (NUM_VC * NUM_ROUTER)+ (NUM_VC*GLOBAL_CHANNELS) + (NUM_VC * NUM_TERMINALS)
-
 // debugging parameters
 #define DEBUG 1
-#define TRACK 601
-#define PRINT_ROUTER_TABLE 1
-
-#define NUM_ROWS NUM_ROUTER*NUM_TERMINALS
-#define NUM_COLS (NUM_ROUTER*NUM_TERMINALS)+1
-#define TERMINAL_WAITING_PACK_COUNT 1 << 16
-#define ROUTER_WAITING_PACK_COUNT 1 << 18
 
-extern FILE *dragonfly_event_log;
+// maximum number of packets waiting in a terminal/router, packets beyond it are dropped
+#define TERMINAL_WAITING_PACK_COUNT (1 << 16)
+#define ROUTER_WAITING_PACK_COUNT (1 << 18)
+// waiting packets are carved out of a per-PE slab that grows WAITING_SLAB_SIZE records at a time
+#define WAITING_SLAB_SIZE 1024
 
 // arrival rate
 static double MEAN_INTERVAL=200.0;
@@ -62,6 +53,7 @@ typedef struct buf_space_message buf_space_message;
 typedef struct router_state router_state;
 typedef struct waiting_packet waiting_packet;
 typedef struct process_state process_state;
+typedef struct group_route group_route;
 
 struct terminal_state
 {
@@ -75,11 +67,9 @@ struct terminal_state
    tw_stime terminal_available_time;
    tw_stime next_credit_available_time;
    
-   //first element of linked list
-   struct waiting_packet * waiting_list;
-
-  // pointer to the linked list
-   struct waiting_packet * head;   
+   // FIFO of packets waiting for buffer space on each virtual channel
+   struct waiting_packet * wait_head[NUM_VC];
+   struct waiting_packet * wait_tail[NUM_VC];
    int wait_count;
    int packet_counter;
 // Terminal generate, sends and arrival T_SEND, T_ARRIVAL, T_GENERATE
@@ -134,7 +124,9 @@ enum TRAFFIC_PATTERN
   TRANSPOSE,
   NEAREST_NEIGHBOR,
   BISECTION,
-  NEAREST_ROUTER
+  NEAREST_ROUTER,
+  // destinations read from --traffic_file
+  TRAFFIC_FILE
 };
 
 struct terminal_message
@@ -165,9 +157,14 @@ struct terminal_message
 
    int intm_group_id;
    short wait_type;
-   short wait_loc;
    short chunk_id;
 //   short route;
+
+   // waiting packet released by a credit, kept until commit for reverse computation (BUFFER)
+   struct waiting_packet * wait_rec;
+
+   // receive time of the event, the commit handlers use it for the event trace and the statistics
+   tw_stime event_time;
 };
 
 struct router_state
@@ -175,29 +172,31 @@ struct router_state
    unsigned int router_id;
    unsigned int group_id;
   
-   int global_channel[GLOBAL_CHANNELS]; 
+   // the arrays below are slices of router_arena, num_global_channel and radix entries long
+   int * global_channel; 
 
-   // 0--NUM_ROUTER-1 local router indices (router-router intragroup channels)
-   // NUM_ROUTER -- NUM_ROUTER+GLOBAL_CHANNELS-1 global channel indices (router-router inter-group channels)
-   // NUM_ROUTER+GLOBAL_CHANNELS -- RADIX-1 terminal indices (router-terminal channels)
-   tw_stime next_output_available_time[RADIX];
+   // 0--num_router-1 local router indices (router-router intragroup channels)
+   // num_router -- num_router+num_global_channel-1 global channel indices (router-router inter-group channels)
+   // num_router+num_global_channel -- radix-1 terminal indices (router-terminal channels)
+   tw_stime * next_output_available_time;
 //   tw_stime next_input_available_time[RADIX];
 
 //   tw_stime next_available_time;
-   tw_stime next_credit_available_time[RADIX];
+   tw_stime * next_credit_available_time;
 //   tw_stime next_credit_available_time[RADIX];
 
 //   unsigned int credit_occupancy[RADIX];   
-   int vc_occupancy[RADIX];
+   int * vc_occupancy;
 
 //   unsigned int input_vc_state[RADIX];
-   unsigned int output_vc_state[RADIX];
+   unsigned int * output_vc_state;
 
-   //first element of linked list
-   struct waiting_packet * waiting_list;
+   // next router and output port towards every group
+   struct group_route * route;
 
-  // pointer to the linked list
-   struct waiting_packet * head;
+   // FIFO of packets waiting for buffer space on each output channel
+   struct waiting_packet ** wait_head;
+   struct waiting_packet ** wait_tail;
    int wait_count;
 };
 
@@ -212,13 +211,43 @@ struct process_state
    int row, col;
 };
 
+// Minimal route from a router to another group: the next router (a local router holding a global
+// channel to that group, or the router across the global channel) and the output port leading to it
+struct group_route
+{
+   unsigned int next_stop;
+   int output_port;
+};
+
+// Per-PE arena holding the channel arrays and the route row of every router of this PE,
+// router_arena_stride bytes per router indexed by the local LP id
+static char * router_arena = NULL;
+static size_t router_arena_stride;
+
+// Waiting packet record, holds only the fields a T_SEND/R_SEND of the packet reads so that it never
+// points into event memory. A BUFFER event that releases a record keeps it as the rollback handle.
 struct waiting_packet
 {
-   terminal_message * packet;
+   tw_stime travel_start_time;
+   unsigned long long packet_ID;
+   unsigned int dest_terminal_id;
+   unsigned int src_terminal_id;
+   unsigned int intm_lp_id;
+   int intm_group_id;
+   short my_N_hop;
+   short saved_vc;
+   short last_hop;
+   short chunk_id;
+   short wait_type;
+
    struct waiting_packet * next;
-   int chan;
+   struct waiting_packet * prev;
 };
 
+// per-PE slab of free waiting packet records
+static struct waiting_packet * waiting_free_list = NULL;
+static long waiting_slab_records = 0;
+
 static int       nlp_terminal_per_pe;
 static int       nlp_router_per_pe;
 static int 	 nlp_mpi_procs_per_pe;
@@ -226,8 +255,28 @@ static int opt_mem = 10000;
 static int mem_factor = 32;
 static int max_packets = 0;
 
+// --mapping=group places whole groups on one PE and KP instead of splitting every LP type separately
+static int group_mapping = 0;
+static char mapping_str[32] = "linear";
+
+// --event_trace=PREFIX writes every committed event to the binary trace PREFIX.<rank>
+static char event_trace[1024] = "";
+
+// --fast_path=N: R_ARRIVE elision, local hops that find fewer than N chunks in the channel skip the R_ARRIVE
+// event of the next router and schedule their credit themselves, 0 models every hop with events
+static int fast_path = 0;
+
+// --profile=1 counts and times the handlers per LP class and event type, see dragonfly-profile.h
+static int handler_profile = 0;
+
+// width of the latency histogram bins in ns, see dragonfly-stats.h. Unloaded packets take
+// roughly 100 to 150 ns, the 256 bins cover 512 ns by default
+static tw_stime latency_bin = 2.0;
+
 static int ROUTING= MINIMAL;
 static int traffic= NEAREST_NEIGHBOR;
+// --traffic_file=FILE gives the destination terminal of every MPI process
+static char traffic_file[1024] = "";
 int minimal_count, nonmin_count;
 
 int adaptive_threshold;
@@ -236,23 +285,20 @@ int num_packets;
 int num_chunks;
 int packet_offset;
 
-tw_stime         average_travel_time = 0;
-tw_stime         total_time = 0;
-tw_stime         max_latency = 0;
-
 int range_start;
 int num_vc;
 int terminal_rem=0, router_rem=0;
-int num_terminal=0, num_router=0;
-unsigned long num_groups = NUM_ROUTER*GLOBAL_CHANNELS+1;
+
+// dragonfly shape: routers per group, terminals per router and global channels per router (even),
+// a balanced dragonfly has num_router = 2 * num_terminal = 2 * num_global_channel
+int num_router = 8, num_terminal = 4, num_global_channel = 4;
+// channels of each router and number of groups, derived from the shape in main
+int radix;
+unsigned long num_groups;
 int total_routers, total_terminals, total_mpi_procs;
 unsigned long long max_packet;
 
-static unsigned long long       total_hops = 0;
-static unsigned long long       N_finished = 0;
-static unsigned long long       N_finished_storage[N_COLLECT_POINTS];
-static unsigned long long       N_generated_storage[N_COLLECT_POINTS];
-
 void dragonfly_mapping(void);
+void router_global_channels(tw_lpid gid, int * global_channel);
 tw_lp * dragonfly_mapping_to_lp(tw_lpid lpid);
 #endif
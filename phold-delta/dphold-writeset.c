@@ -0,0 +1,376 @@
+#include "dphold-writeset.h"
+
+/* deltas hold 2^k bytes for k up to WS_CLASSES-1, released deltas are kept per size class */
+#define WS_CLASSES 24
+#define WS_MIN_CLASS 5
+
+/* log2 buckets of the size, cycle and memory histograms */
+#define HIST_BUCKETS 40
+/* 0.1 wide buckets of the compression ratio, the last one also counts all larger ratios */
+#define RATIO_BUCKETS 21
+
+/* write set of the event being processed: dirty bitmap, old value of every dirty word and
+ * the number of dirty words */
+static int		 ws_words = 0;
+static int		 ws_n = 0;
+static long		*ws_old = NULL;
+static unsigned long	*ws_dirty = NULL;
+static int		 ws_bitmap_words;
+
+static int		 ws_encoding = ENCODING_RAW;
+static double		 ws_dense = 0;
+
+/* encoding buffer, large enough for the worst case of every encoding */
+static unsigned char	*ws_buffer = NULL;
+
+static dphold_delta	*ws_free[WS_CLASSES];
+
+/* statistics of this process: encoded size and compression ratio of committed deltas, encode
+ * and decode cycles of all of them, bytes held by uncommitted deltas sampled at every encode */
+typedef struct ws_stats ws_stats;
+
+struct ws_stats
+{
+	double		 bytes[HIST_BUCKETS];
+	double		 ratio[RATIO_BUCKETS];
+	double		 encode[HIST_BUCKETS];
+	double		 decode[HIST_BUCKETS];
+	double		 held[HIST_BUCKETS];
+	double		 encoded[ENCODING_BITMAP + 1];
+};
+
+static ws_stats		 stats;
+static long		 held_bytes = 0;
+static long		 held_max = 0;
+
+static const char	*encoding_names[] = { "raw", "rle", "xor", "bitmap" };
+
+#define WS_BITS (8 * sizeof(unsigned long))
+
+void
+dphold_writeset_init(int n_words, int encoding, double dense)
+{
+	if (n_words > 65536)
+		tw_error(TW_LOC, "write set tracking supports at most 65536 state words, not %d", n_words);
+
+	ws_words = n_words;
+	ws_encoding = encoding;
+	ws_dense = dense;
+	ws_bitmap_words = n_words / WS_BITS + 1;
+	ws_old = tw_calloc(TW_LOC, "write set", sizeof(long), n_words);
+	ws_dirty = tw_calloc(TW_LOC, "write set", sizeof(unsigned long), ws_bitmap_words);
+	// worst case: xor with a 3 byte gap and a 10 byte value per word
+	ws_buffer = tw_calloc(TW_LOC, "write set", 13, n_words + ws_bitmap_words);
+}
+
+void
+dphold_writeset_write(long * state, int i, long v)
+{
+	unsigned long bit = 1UL << (i % WS_BITS);
+
+	if (!(ws_dirty[i / WS_BITS] & bit)) {
+		ws_dirty[i / WS_BITS] |= bit;
+		ws_old[i] = state[i];
+		ws_n++;
+	}
+	state[i] = v;
+}
+
+static int
+log2_bucket(unsigned long v)
+{
+	int b = 0;
+
+	while (v >>= 1)
+		b++;
+	return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+static unsigned char *
+put_varint(unsigned char * p, unsigned long v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static const unsigned char *
+get_varint(const unsigned char * p, unsigned long * v)
+{
+	int shift = 0;
+
+	*v = 0;
+	do {
+		*v |= (unsigned long) (*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	return p;
+}
+
+/* next dirty word at or after i, ws_words when there is none */
+static int
+next_dirty(int i)
+{
+	int w = i / WS_BITS;
+	unsigned long bits;
+
+	if (i >= ws_words)
+		return ws_words;
+
+	bits = ws_dirty[w] & (~0UL << (i % WS_BITS));
+	while (!bits) {
+		if (++w >= ws_bitmap_words)
+			return ws_words;
+		bits = ws_dirty[w];
+	}
+	return w * WS_BITS + __builtin_ctzl(bits);
+}
+
+/* encodes the dirty words into ws_buffer in index order, returns the size */
+static int
+encode(long * state, int encoding)
+{
+	unsigned char	*p = ws_buffer;
+	unsigned short	 index;
+	int		 i, run, prev = 0;
+
+	switch (encoding) {
+	case ENCODING_RAW:
+		for (i = next_dirty(0); i < ws_words; i = next_dirty(i + 1)) {
+			index = i;
+			memcpy(p, &index, sizeof(index));
+			memcpy(p + sizeof(index), &ws_old[i], sizeof(long));
+			p += sizeof(index) + sizeof(long);
+		}
+		break;
+
+	case ENCODING_RLE:
+		for (i = next_dirty(0); i < ws_words; i = next_dirty(i + run)) {
+			for (run = 1; i + run < ws_words && next_dirty(i + run) == i + run; run++)
+				;
+			p = put_varint(p, i - prev);
+			p = put_varint(p, run);
+			memcpy(p, &ws_old[i], run * sizeof(long));
+			p += run * sizeof(long);
+			prev = i + run;
+		}
+		break;
+
+	case ENCODING_XOR:
+		for (i = next_dirty(0); i < ws_words; i = next_dirty(i + 1)) {
+			p = put_varint(p, i - prev);
+			p = put_varint(p, (unsigned long) (ws_old[i] ^ state[i]));
+			prev = i + 1;
+		}
+		break;
+
+	case ENCODING_BITMAP:
+		memcpy(p, ws_dirty, ws_bitmap_words * sizeof(unsigned long));
+		p += ws_bitmap_words * sizeof(unsigned long);
+		for (i = next_dirty(0); i < ws_words; i = next_dirty(i + 1)) {
+			memcpy(p, &ws_old[i], sizeof(long));
+			p += sizeof(long);
+		}
+		break;
+	}
+	return p - ws_buffer;
+}
+
+static dphold_delta *
+delta_alloc(int bytes)
+{
+	dphold_delta	*d;
+	int		 c = WS_MIN_CLASS;
+
+	while ((1 << c) < bytes)
+		c++;
+	if (c >= WS_CLASSES)
+		tw_error(TW_LOC, "delta of %d bytes exceeds the largest size class", bytes);
+
+	if ((d = ws_free[c])) {
+		ws_free[c] = d->next;
+		return d;
+	}
+
+	d = tw_calloc(TW_LOC, "delta", sizeof(dphold_delta) + (1 << c), 1);
+	d->size_class = c;
+	d->data = (unsigned char *) (d + 1);
+	return d;
+}
+
+dphold_delta *
+dphold_writeset_take(long * state)
+{
+	dphold_delta	*d;
+	tw_clock	 start = tw_clock_read();
+	int		 encoding = ws_encoding;
+	int		 i, bytes;
+
+	if (!ws_n)
+		return NULL;
+
+	if (ws_dense > 0 && ws_n >= ws_dense * ws_words)
+		encoding = ENCODING_BITMAP;
+
+	bytes = encode(state, encoding);
+	d = delta_alloc(bytes);
+	d->encoding = encoding;
+	d->n = ws_n;
+	d->bytes = bytes;
+	memcpy(d->data, ws_buffer, bytes);
+
+	// only the bitmap words of the touched words have bits to clear
+	for (i = next_dirty(0); i < ws_words; i = next_dirty(i + 1))
+		ws_dirty[i / WS_BITS] = 0;
+	ws_n = 0;
+
+	stats.encode[log2_bucket(tw_clock_read() - start)]++;
+
+	held_bytes += bytes;
+	if (held_max < held_bytes)
+		held_max = held_bytes;
+	stats.held[log2_bucket(held_bytes)]++;
+
+	return d;
+}
+
+static void
+delta_free(dphold_delta * d)
+{
+	held_bytes -= d->bytes;
+	d->next = ws_free[d->size_class];
+	ws_free[d->size_class] = d;
+}
+
+void
+dphold_writeset_release(dphold_delta * d)
+{
+	int raw, r;
+
+	if (!d)
+		return;
+
+	raw = d->n * (sizeof(unsigned short) + sizeof(long));
+	r = 10 * d->bytes / raw;
+	stats.bytes[log2_bucket(d->bytes)]++;
+	stats.ratio[r < RATIO_BUCKETS ? r : RATIO_BUCKETS - 1]++;
+	stats.encoded[d->encoding]++;
+
+	delta_free(d);
+}
+
+void
+dphold_writeset_restore(long * state, dphold_delta * d)
+{
+	const unsigned char	*p;
+	const unsigned long	*bitmap;
+	unsigned long		 gap, run, x;
+	unsigned short		 index;
+	tw_clock		 start = tw_clock_read();
+	int			 i, k, w;
+
+	if (!d)
+		return;
+
+	p = d->data;
+	switch (d->encoding) {
+	case ENCODING_RAW:
+		for (k = 0; k < d->n; k++) {
+			memcpy(&index, p, sizeof(index));
+			memcpy(&state[index], p + sizeof(index), sizeof(long));
+			p += sizeof(index) + sizeof(long);
+		}
+		break;
+
+	case ENCODING_RLE:
+		for (i = 0, k = 0; k < d->n; k += run) {
+			p = get_varint(p, &gap);
+			p = get_varint(p, &run);
+			i += gap;
+			memcpy(&state[i], p, run * sizeof(long));
+			p += run * sizeof(long);
+			i += run;
+		}
+		break;
+
+	case ENCODING_XOR:
+		for (i = 0, k = 0; k < d->n; k++) {
+			p = get_varint(p, &gap);
+			p = get_varint(p, &x);
+			i += gap;
+			state[i] ^= x;
+			i++;
+		}
+		break;
+
+	case ENCODING_BITMAP:
+		bitmap = (const unsigned long *) p;
+		p += ws_bitmap_words * sizeof(unsigned long);
+		for (w = 0; w < ws_bitmap_words; w++)
+			for (x = bitmap[w]; x; x &= x - 1) {
+				memcpy(&state[w * WS_BITS + __builtin_ctzl(x)], p, sizeof(long));
+				p += sizeof(long);
+			}
+		break;
+	}
+
+	stats.decode[log2_bucket(tw_clock_read() - start)]++;
+	delta_free(d);
+}
+
+long
+dphold_delta_bytes(const dphold_delta * d)
+{
+	if (!d)
+		return 0;
+
+	return d->bytes;
+}
+
+static void
+print_log2_hist(const char * name, const double * hist)
+{
+	int b;
+
+	printf("%s\n", name);
+	for (b = 0; b < HIST_BUCKETS; b++)
+		if (hist[b])
+			printf("  [%lu, %lu) %.0lf\n", 1UL << b, 2UL << b, hist[b]);
+}
+
+void
+dphold_writeset_report(void)
+{
+	ws_stats	 total;
+	long		 max;
+	int		 b;
+
+	MPI_Reduce(&stats, &total, sizeof(ws_stats) / sizeof(double), MPI_DOUBLE, MPI_SUM,
+		   g_tw_masternode, MPI_COMM_WORLD);
+	MPI_Reduce(&held_max, &max, 1, MPI_LONG, MPI_MAX, g_tw_masternode, MPI_COMM_WORLD);
+
+	if (g_tw_mynode != g_tw_masternode)
+		return;
+
+	printf("committed deltas by encoding:");
+	for (b = 0; b <= ENCODING_BITMAP; b++)
+		printf(" %s %.0lf", encoding_names[b], total.encoded[b]);
+	printf("\n");
+
+	print_log2_hist("committed encoded delta bytes", total.bytes);
+
+	printf("committed compression ratio against raw\n");
+	for (b = 0; b < RATIO_BUCKETS - 1; b++)
+		if (total.ratio[b])
+			printf("  [%.1lf, %.1lf) %.0lf\n", b / 10.0, (b + 1) / 10.0, total.ratio[b]);
+	if (total.ratio[b])
+		printf("  [%.1lf, inf) %.0lf\n", b / 10.0, total.ratio[b]);
+
+	print_log2_hist("encode cycles", total.encode);
+	print_log2_hist("decode cycles", total.decode);
+	print_log2_hist("bytes held by uncommitted deltas on a process, sampled per encode", total.held);
+	printf("most bytes held by uncommitted deltas on a process %ld\n", max);
+}
@@ -0,0 +1,67 @@
+#ifndef INC_dphold_writeset_h
+#define INC_dphold_writeset_h
+
+#include <ross.h>
+
+	/*
+	 * Write-set tracking state access (--writeset=1)
+	 *
+	 * Instead of copying the whole state with tw_snapshot before an event and diffing it
+	 * afterwards, the model writes state words through dphold_writeset_write.  The first
+	 * write of a word in an event saves its old value, so the rollback delta of the event
+	 * is built directly from the words it touched and costs O(words touched).
+	 *
+	 * Deltas are stored encoded (--encoding):
+	 *   raw	16 bit word indices followed by the old values
+	 *   rle	runs of consecutive words: varint gap, varint run length, old values
+	 *   xor	varint gap and varint (old ^ new) per word, small for small changes
+	 * A delta touching at least a fraction --dense of the state is stored as a bitmap of
+	 * the touched words followed by their old values instead, which encodes and decodes
+	 * with plain copies.
+	 */
+
+enum dphold_encoding
+{
+	ENCODING_RAW,
+	ENCODING_RLE,
+	ENCODING_XOR,
+	ENCODING_BITMAP
+};
+
+typedef struct dphold_delta dphold_delta;
+
+struct dphold_delta
+{
+	dphold_delta	*next;		/* free list link */
+	int		 size_class;
+	int		 encoding;
+	int		 n;		/* words saved */
+	int		 bytes;		/* encoded size */
+	unsigned char	*data;
+};
+
+/* state of n_words longs (at most 65536), deltas with at least dense * n_words words are
+ * stored as bitmaps, 0 never */
+void dphold_writeset_init(int n_words, int encoding, double dense);
+
+/* writes state[i] = v, saving the old value on the first write of i in this event */
+void dphold_writeset_write(long * state, int i, long v);
+
+/* ends the event: encodes the saved words of state as its delta (NULL when nothing was written) */
+dphold_delta * dphold_writeset_take(long * state);
+
+/* writes the saved words back into state and releases the delta */
+void dphold_writeset_restore(long * state, dphold_delta * d);
+
+/* releases the delta of a committed event */
+void dphold_writeset_release(dphold_delta * d);
+
+/* encoded size of the delta */
+long dphold_delta_bytes(const dphold_delta * d);
+
+/* combines the statistics of all processes and prints, on the master, histograms of encoded size
+ * and compression ratio against the raw encoding of committed deltas, encode and decode cycles
+ * and the bytes held by uncommitted deltas */
+void dphold_writeset_report(void);
+
+#endif
@@ -1,6 +1,7 @@
 #include "dphold.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <math.h>
 
 /* Arrange the N elements of ARRAY in random order.
    Only effective if N is much smaller than RAND_MAX;
@@ -27,15 +28,34 @@ phold_map(tw_lpid gid)
 	return (tw_peid) gid / g_tw_nlp;
 }
 
-typedef struct {
-  unsigned long delta_count;
-  double delta_average;
-  double state_changed;
-} delta_info;
-
 #define DI_SIZE DUMMY_SIZE
 
-delta_info DI[DI_SIZE];
+	/*
+	 * Delta statistics of every PE.  Committed events are counted by the commit handler and
+	 * rolled back executions by the reverse handler, nothing is counted in the forward
+	 * handler.  All fields are doubles so that the statistics of all PEs go in one reduction.
+	 */
+typedef struct {
+  double committed;
+  double committed_bytes;
+  double committed_cycles;
+  double rolled_back;
+  double rolled_back_bytes;
+  double rolled_back_cycles;
+  // committed events and their summed delta fraction of the state, by number of writes
+  double writes_count[DI_SIZE + 1];
+  double writes_delta[DI_SIZE + 1];
+} phold_pe_stats;
+
+static phold_pe_stats *pe_stats = NULL;
+
+// ROSS numbers the PEs of a process consecutively
+static phold_pe_stats *
+phold_stats(tw_lp * lp)
+{
+  return &pe_stats[lp->pe->id % g_tw_npe];
+}
+
 int order[DI_SIZE];
 
 void
@@ -43,12 +63,8 @@ phold_init(phold_state * s, tw_lp * lp)
 {
 	int              i;
 
-	for (i = 0; i < DI_SIZE; i++) {
-	  DI[i].delta_count = 0;
-	  DI[i].delta_average = 0.0;
-	  DI[i].state_changed = 0.0;
+	for (i = 0; i < DI_SIZE; i++)
 	  order[i] = i;
-	}
 
 	if( stagger )
 	  {
@@ -91,40 +107,168 @@ phold_pre_run(phold_state * s, tw_lp * lp)
 	tw_event_send(tw_event_new(dest, tw_rand_exponential(lp->rng, mean) + lookahead, lp));
 }
 
-static unsigned long delta_count = 0;
-static double delta_average = 0.0;
+// set for the event being processed when its writes go through the write set
+static int track_writes = 0;
 
+static void
+phold_write(phold_state * s, int i, long v)
+{
+  if (track_writes)
+    dphold_writeset_write(s->dummy_state, i, v);
+  else
+    s->dummy_state[i] = v;
+}
 
+	/*
+	 * Mutation patterns (--pattern)
+	 *
+	 * Every pattern draws the words to change and their values from lp->rng only, the
+	 * handler counts the draws in m->rng_count so the reverse handler can undo them.
+	 */
+
+// words picked by the sparse pattern in this event, cleared again through order[]
+static unsigned char picked[DUMMY_SIZE];
+// cumulative Zipf distribution over the state words, word 0 is the hottest
+static double *zipf_cdf = NULL;
 
 void
-phold_event_handler(phold_state * s, tw_bf * bf, phold_message * m, tw_lp * lp)
+phold_pattern_init(void)
 {
-  long delta_size;
+  double sum = 0;
   int i;
-  int idx;
+
+  if (!strcmp(pattern_str, "shuffle"))
+    pattern = PATTERN_SHUFFLE;
+  else if (!strcmp(pattern_str, "sparse"))
+    pattern = PATTERN_SPARSE;
+  else if (!strcmp(pattern_str, "run"))
+    pattern = PATTERN_RUN;
+  else if (!strcmp(pattern_str, "stride"))
+    pattern = PATTERN_STRIDE;
+  else if (!strcmp(pattern_str, "zipf"))
+    pattern = PATTERN_ZIPF;
+  else if (!strcmp(pattern_str, "whole"))
+    pattern = PATTERN_WHOLE;
+  else
+    tw_error(TW_LOC, "Unknown mutation pattern %s", pattern_str);
+
+  if (stride < 1)
+    tw_error(TW_LOC, "stride must be at least 1");
+
+  if (pattern == PATTERN_ZIPF) {
+    zipf_cdf = tw_calloc(TW_LOC, "zipf", sizeof(double), DUMMY_SIZE);
+    for (i = 0; i < DUMMY_SIZE; i++) {
+      sum += 1.0 / pow(i + 1, zipf_exponent);
+      zipf_cdf[i] = sum;
+    }
+    for (i = 0; i < DUMMY_SIZE; i++)
+      zipf_cdf[i] /= sum;
+  }
+}
+
+static int
+zipf_word(tw_rng_stream * g)
+{
+  double u = tw_rand_unif(g);
+  int lo = 0, hi = DUMMY_SIZE - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (zipf_cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// changes state words according to the pattern, returns the number of writes
+unsigned
+phold_mutate(phold_state * s, tw_lp * lp)
+{
+  unsigned count, i;
+  int j, t, start;
+
+  if (pattern == PATTERN_WHOLE) {
+    for (i = 0; i < DUMMY_SIZE; i++)
+      phold_write(s, i, tw_rand_integer(lp->rng, 0, LONG_MAX));
+    return DUMMY_SIZE;
+  }
+
+  // Generate the number of items to change
+  count = tw_rand_ulong(lp->rng, 1, DI_SIZE / 4);
+
+  switch (pattern) {
+  case PATTERN_SHUFFLE:
+    // Shuffle the order, then change the items located at order[0 .. count-1]. The order
+    // starts from the identity every time, so a re-executed event picks the same words
+    for (i = 0; i < DI_SIZE; i++)
+      order[i] = i;
+    shuffle(lp->rng, order, DI_SIZE - 2);
+    for (i = 0; i < count; i++)
+      phold_write(s, order[i], tw_rand_integer(lp->rng, 0, LONG_MAX));
+    break;
+
+  case PATTERN_SPARSE:
+    // Floyd's sampling: count distinct words with count draws instead of a full shuffle
+    for (i = 0, j = DUMMY_SIZE - count; j < DUMMY_SIZE; i++, j++) {
+      t = tw_rand_integer(lp->rng, 0, j);
+      if (picked[t])
+        t = j;
+      picked[t] = 1;
+      order[i] = t;
+      phold_write(s, t, tw_rand_integer(lp->rng, 0, LONG_MAX));
+    }
+    for (i = 0; i < count; i++)
+      picked[order[i]] = 0;
+    break;
+
+  case PATTERN_RUN:
+    start = tw_rand_integer(lp->rng, 0, DUMMY_SIZE - count);
+    for (i = 0; i < count; i++)
+      phold_write(s, start + i, tw_rand_integer(lp->rng, 0, LONG_MAX));
+    break;
+
+  case PATTERN_STRIDE:
+    // every stride-th word from a random start, fewer words when they do not fit
+    if ((count - 1) * stride >= DUMMY_SIZE)
+      count = (DUMMY_SIZE - 1) / stride + 1;
+    start = tw_rand_integer(lp->rng, 0, DUMMY_SIZE - 1 - (count - 1) * stride);
+    for (i = 0; i < count; i++)
+      phold_write(s, start + i * stride, tw_rand_integer(lp->rng, 0, LONG_MAX));
+    break;
+
+  case PATTERN_ZIPF:
+    // hot words are written again and again, the write set keeps one copy of each
+    for (i = 0; i < count; i++)
+      phold_write(s, zipf_word(lp->rng), tw_rand_integer(lp->rng, 0, LONG_MAX));
+    break;
+  }
+  return count;
+}
+
+
+void
+phold_event_handler(phold_state * s, tw_bf * bf, phold_message * m, tw_lp * lp)
+{
   unsigned count;
   tw_lpid	 dest;
   long start_count = lp->rng->count;
+  // the whole handler is timed in both modes, so the tracked writes count against the write set
+  tw_clock start = tw_clock_read();
 
   // This should be the FIRST thing to do in your event handler
   if (g_tw_synchronization_protocol == OPTIMISTIC ||
       g_tw_synchronization_protocol == OPTIMISTIC_DEBUG) {
     // Only do this in OPTIMISTIC mode
-    tw_snapshot(lp, lp->type->state_sz);
+    if (writeset)
+      track_writes = 1;
+    else
+      tw_snapshot(lp, lp->type->state_sz);
   }
 
-  // Generate the number of items to change
-  count = tw_rand_ulong(lp->rng, 1, DI_SIZE / 4);
-  idx = count;
-
-  // Shuffle the order
-  shuffle(lp->rng, order, DI_SIZE - 2);
-
-  // Change 'count' items
-  for (i = 0; i < count; i++) {
-    // Change the item located at index order[i]
-    s->dummy_state[order[i]] = tw_rand_integer(lp->rng, 0, LONG_MAX);
-  }
+  // Change the state according to the mutation pattern
+  count = phold_mutate(s, lp);
 
   if(tw_rand_unif(lp->rng) <= percent_remote)
     {
@@ -147,21 +291,17 @@ phold_event_handler(phold_state * s, tw_bf * bf, phold_message * m, tw_lp * lp)
   // (Take care to cover all possible exits!)
   if (g_tw_synchronization_protocol == OPTIMISTIC ||
       g_tw_synchronization_protocol == OPTIMISTIC_DEBUG) {
-    double temp = delta_average;
     // Only do this in OPTIMISTIC mode
-    delta_size = tw_snapshot_delta(lp, lp->type->state_sz);
-    // Update the average
-    temp *= delta_count;
-    temp += (double)delta_size / lp->type->state_sz;
-    delta_count++;
-    delta_average = temp / delta_count;
+    if (writeset) {
+      m->delta = dphold_writeset_take(s->dummy_state);
+      m->delta_size = dphold_delta_bytes(m->delta);
+      track_writes = 0;
+    } else
+      m->delta_size = tw_snapshot_delta(lp, lp->type->state_sz);
     m->rng_count = lp->rng->count - start_count;
-    temp = DI[idx].delta_average;
-    temp *= DI[idx].delta_count;
-    temp += (double)delta_size / lp->type->state_sz;
-    DI[idx].delta_count = DI[idx].delta_count + 1;
-    DI[idx].delta_average = temp / DI[idx].delta_count;
-    DI[idx].state_changed = (double)(count * sizeof(double)) / lp->type->state_sz;
+    // counted when the event commits or is rolled back
+    m->writes = count;
+    m->handler_cycles = tw_clock_read() - start;
   }
 }
 
@@ -171,11 +311,42 @@ phold_event_handler_rc(phold_state * s, tw_bf * bf, phold_message * m, tw_lp * l
     // We don't need to check g_tw_synchronization_protocol here since if
     // this gets called, we must be in an OPTIMISTIC mode anyway
     long count = m->rng_count;
+    phold_pe_stats *ps = phold_stats(lp);
     // This should be the FIRST thing to do in your reverse event handler
-    tw_snapshot_restore(lp, lp->type->state_sz);
+    if (writeset) {
+      dphold_writeset_restore(s->dummy_state, m->delta);
+      m->delta = NULL;
+    } else
+      tw_snapshot_restore(lp, lp->type->state_sz);
     while (count--) {
         tw_rand_reverse_unif(lp->rng);
     }
+
+    ps->rolled_back++;
+    ps->rolled_back_bytes += m->delta_size;
+    ps->rolled_back_cycles += m->handler_cycles;
+}
+
+void
+phold_commit(phold_state * s, tw_bf * bf, phold_message * m, tw_lp * lp)
+{
+    phold_pe_stats *ps = phold_stats(lp);
+
+    if (g_tw_synchronization_protocol != OPTIMISTIC &&
+	g_tw_synchronization_protocol != OPTIMISTIC_DEBUG)
+      return;
+
+    ps->committed++;
+    ps->committed_bytes += m->delta_size;
+    ps->committed_cycles += m->handler_cycles;
+    ps->writes_count[m->writes]++;
+    ps->writes_delta[m->writes] += (double)m->delta_size / lp->type->state_sz;
+
+    // a committed event is never rolled back, its saved words can be reused
+    if (writeset) {
+      dphold_writeset_release(m->delta);
+      m->delta = NULL;
+    }
 }
 
 void
@@ -189,7 +360,7 @@ tw_lptype       mylps[] = {
      (pre_run_f) NULL,
 	 (event_f) phold_event_handler,
 	 (revent_f) phold_event_handler_rc,
-	 (commit_f) NULL,
+	 (commit_f) phold_commit,
 	 (final_f) phold_finish,
 	 (map_f) phold_map,
 	sizeof(phold_state)},
@@ -207,6 +378,12 @@ const tw_optdef app_opt[] =
 	TWOPT_UINT("start-events", g_phold_start_events, "number of initial messages per LP"),
 	TWOPT_UINT("stagger", stagger, "Set to 1 to stagger event uniformly across 0 to end time."),
 	TWOPT_UINT("memory", optimistic_memory, "additional memory buffers"),
+	TWOPT_CHAR("pattern", pattern_str, "state mutation pattern: shuffle, sparse, run, stride, zipf or whole"),
+	TWOPT_UINT("stride", stride, "distance in words between the writes of the stride pattern"),
+	TWOPT_STIME("zipf", zipf_exponent, "exponent of the zipf pattern's word popularity"),
+	TWOPT_UINT("writeset", writeset, "1 = save only the state words an event writes, 0 = snapshot the whole state"),
+	TWOPT_CHAR("encoding", encoding_str, "write set delta encoding: raw, rle or xor"),
+	TWOPT_STIME("dense", dense, "deltas writing at least this fraction of the state are stored as bitmaps, 0 = never"),
 	TWOPT_CHAR("run", run_id, "user supplied run name"),
 	TWOPT_END()
 };
@@ -214,7 +391,8 @@ const tw_optdef app_opt[] =
 int
 main(int argc, char **argv, char **env)
 {
-	int		 i;
+	int		 i, j;
+	phold_pe_stats	 total;
 
         // get rid of error if compiled w/ MEMORY queues
         g_tw_memory_nqueues=1;
@@ -239,6 +417,19 @@ main(int argc, char **argv, char **env)
 	g_tw_lookahead = lookahead;
 
 	tw_define_lps(nlp_per_pe, sizeof(phold_message));
+	pe_stats = tw_calloc(TW_LOC, "phold stats", sizeof(phold_pe_stats), g_tw_npe);
+
+	phold_pattern_init();
+	if (writeset) {
+		if (!strcmp(encoding_str, "raw"))
+			dphold_writeset_init(DUMMY_SIZE, ENCODING_RAW, dense);
+		else if (!strcmp(encoding_str, "rle"))
+			dphold_writeset_init(DUMMY_SIZE, ENCODING_RLE, dense);
+		else if (!strcmp(encoding_str, "xor"))
+			dphold_writeset_init(DUMMY_SIZE, ENCODING_XOR, dense);
+		else
+			tw_error(TW_LOC, "Unknown delta encoding %s", encoding_str);
+	}
 
 	for(i = 0; i < g_tw_nlp; i++)
 		tw_lp_settype(i, &mylps[0]);
@@ -254,21 +445,46 @@ main(int argc, char **argv, char **env)
 	    printf("   Mult...................%lf\n", mult);
 	    printf("   Memory.................%u\n", optimistic_memory);
 	    printf("   Remote.................%lf\n", percent_remote);
+	    printf("   Pattern................%s\n", pattern_str);
+	    printf("   Writeset...............%u\n", writeset);
+	    if (writeset)
+	      printf("   Encoding...............%s dense %lf\n", encoding_str, dense);
 	    printf("========================================\n\n");
 	  }
 
 	tw_run();
-	tw_end();
-
-	if (g_tw_mynode == 0) {
-	  printf("delta_average is %lf over %lu allocations\n", delta_average, delta_count);
 
-	  for (i = 0; i < DI_SIZE; i++) {
-	    if (DI[i].delta_count == 0) continue;
-	    //printf("%d is %lf over %lu allocations\n", i, DI[i].delta_average, DI[i].delta_count);
-	    printf("%lf changed %lf\n", DI[i].state_changed, DI[i].delta_average);
+	// PEs of this process first, then all processes in one reduction
+	for (i = 1; i < g_tw_npe; i++)
+	  for (j = 0; j < sizeof(phold_pe_stats) / sizeof(double); j++)
+	    ((double *) &pe_stats[0])[j] += ((double *) &pe_stats[i])[j];
+
+	MPI_Reduce(&pe_stats[0], &total, sizeof(phold_pe_stats) / sizeof(double),
+		   MPI_DOUBLE, MPI_SUM, g_tw_masternode, MPI_COMM_WORLD);
+
+	if (g_tw_mynode == g_tw_masternode) {
+	  double state_sz = sizeof(phold_state);
+
+	  printf("delta_average is %lf over %.0lf committed events\n",
+		 total.committed ? total.committed_bytes / state_sz / total.committed : 0, total.committed);
+	  printf("rolled back delta_average is %lf over %.0lf rolled back events\n",
+		 total.rolled_back ? total.rolled_back_bytes / state_sz / total.rolled_back : 0, total.rolled_back);
+	  if (total.committed)
+	    printf("handler cycles per event %lf committed, %lf rolled back (%s)\n",
+		   total.committed_cycles / total.committed,
+		   total.rolled_back ? total.rolled_back_cycles / total.rolled_back : 0,
+		   writeset ? "write set" : "snapshot and delta");
+	  for (i = 0; i <= DI_SIZE; i++) {
+	    if (total.writes_count[i] == 0) continue;
+	    printf("%lf changed %lf\n", (double)(i * sizeof(double)) / state_sz,
+		   total.writes_delta[i] / total.writes_count[i]);
 	  }
 	}
 
+	if (writeset)
+	  dphold_writeset_report();
+
+	tw_end();
+
 	return 0;
 }
@@ -2,6 +2,7 @@
 #define INC_phold_h
 
 #include <ross.h>
+#include "dphold-writeset.h"
 
 	/*
 	 * PHOLD Types
@@ -21,6 +22,12 @@ struct phold_message
 {
 	long int	 dummy_data;
     long rng_count;
+    // words this event overwrote, with --writeset=1
+    dphold_delta *delta;
+    // bytes of the rollback delta, state writes and cycles of the forward handler
+    long delta_size;
+    unsigned writes;
+    tw_clock handler_cycles;
 };
 
 	/*
@@ -35,6 +42,26 @@ static unsigned int ttl_lps = 0;
 static unsigned int nlp_per_pe = 8;
 static int g_phold_start_events = 1;
 static int optimistic_memory = 100;
+enum mutation_pattern
+{
+	PATTERN_SHUFFLE,	/* count random words after a full shuffle of the word order */
+	PATTERN_SPARSE,		/* count random words sampled without a shuffle */
+	PATTERN_RUN,		/* count contiguous words */
+	PATTERN_STRIDE,		/* count words stride apart */
+	PATTERN_ZIPF,		/* count writes to zipf distributed words */
+	PATTERN_WHOLE		/* every word of the state */
+};
+
+static char pattern_str[32] = "shuffle";
+static int pattern = PATTERN_SHUFFLE;
+static unsigned int stride = 8;
+static tw_stime zipf_exponent = 1.0;
+
+// 1 = save only the state words an event writes, 0 = tw_snapshot of the whole state
+static unsigned int writeset = 0;
+// delta encoding of the write set and the fraction of the state above which deltas are bitmaps
+static char encoding_str[32] = "raw";
+static tw_stime dense = 0;
 
 // rate for timestamp exponential distribution
 static tw_stime mean = 1.0;
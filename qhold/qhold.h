@@ -50,4 +50,38 @@ extern unsigned int remoteFractDenominator;
 extern double percent_remote;
 extern unsigned optimistic_memory;
 
+// Distribution of the delay between an event and the event it schedules
+enum qhold_delay {
+    DELAY_UNIFORM,      // 32-bit uniform integer, the original qhold
+    DELAY_EXPONENTIAL,  // exponential with the given mean, the original qhold_fp
+    DELAY_BIMODAL,      // two exponentials, a fraction of the delays bimodal_ratio times longer
+    DELAY_PARETO,       // Pareto heavy tail with the given mean and shape
+    DELAY_TIES,         // constant mean, every event of an LP ties with others
+    DELAY_WEIBULL,      // Weibull with the given mean and shape
+    DELAY_COUNT
+};
+
+// qhold_fp builds this driver with -DQHOLD_DEFAULT_DELAY=DELAY_EXPONENTIAL
+#ifndef QHOLD_DEFAULT_DELAY
+#define QHOLD_DEFAULT_DELAY DELAY_UNIFORM
+#endif
+
+extern int delay;
+extern char delay_name[32];
+extern char preset_name[32];
+extern double mean;
+extern double shape;
+extern double bimodal_fraction;
+extern double bimodal_ratio;
+
+// Applies --preset to the defaults of the delay options and the population, call before tw_init
+// so that options given explicitly override the preset
+void qhold_preset(int argc, char *argv[]);
+
+// Resolves --delay and checks the delay options, call after tw_init
+void qhold_configure(void);
+
+// Prints the delay distribution and the parameters it uses
+void qhold_print_delay(void);
+
 #endif /* _QHOLD_H */
@@ -22,6 +22,163 @@ unsigned long int globalZeroDelaysR = 0;
 double percent_remote = 0.1;
 unsigned optimistic_memory = 1024;
 
+// Delay distribution, see enum qhold_delay
+char delay_name[32] = "";
+char preset_name[32] = "";
+double mean = 1.0;
+double shape = 1.5;
+double bimodal_fraction = 0.1;
+double bimodal_ratio = 100.0;
+
+int delay = QHOLD_DEFAULT_DELAY;
+
+// Scale of the Pareto and Weibull distributions, derived from mean and shape, and the mean
+// of the short bimodal delays, derived from mean, bimodal_fraction and bimodal_ratio
+static double delayScale;
+
+// Names of the distributions and the number of RNG calls each draw makes,
+// the reverse handler undoes that many
+static const struct {
+    const char *name;
+    int rngCount;
+} delays[DELAY_COUNT] = {
+    { "uniform", 1 },
+    { "exponential", 1 },
+    { "bimodal", 2 },
+    { "pareto", 1 },
+    { "ties", 0 },
+    { "weibull", 1 },
+};
+
+// Named queue-stress profiles of the classic hold model experiments
+static const struct {
+    const char *name;
+    int delay;
+    double mean;
+    double shape;
+    unsigned population;
+} presets[] = {
+    { "classic", DELAY_EXPONENTIAL, 1.0, 0, 16 },     // exponential increments, small queue
+    { "large", DELAY_EXPONENTIAL, 1.0, 0, 1024 },     // exponential increments, large queue
+    { "bimodal", DELAY_BIMODAL, 1.0, 0, 64 },         // most events near, a few far in the future
+    { "heavy", DELAY_PARETO, 1.0, 1.1, 64 },          // heavy tail, events spread over many magnitudes
+    { "ties", DELAY_TIES, 1.0, 0, 64 },               // every insertion ties with a queued event
+    { "weibull", DELAY_WEIBULL, 1.0, 0.5, 64 },       // bursty, decreasing hazard rate
+    { NULL },
+};
+
+static int qhold_find_preset(const char *name)
+{
+    int i;
+
+    for (i = 0; presets[i].name; i++) {
+        if (!strcmp(name, presets[i].name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void qhold_preset(int argc, char *argv[])
+{
+    int i, p;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--preset=", 9)) {
+            continue;
+        }
+        p = qhold_find_preset(argv[i] + 9);
+        if (p < 0) {
+            continue;  // reported by qhold_configure
+        }
+        strcpy(delay_name, delays[presets[p].delay].name);
+        mean = presets[p].mean;
+        if (presets[p].shape > 0) {
+            shape = presets[p].shape;
+        }
+        population = presets[p].population;
+    }
+}
+
+void qhold_configure(void)
+{
+    int i;
+
+    if (preset_name[0] && qhold_find_preset(preset_name) < 0) {
+        tw_error(TW_LOC, "Unknown preset %s", preset_name);
+    }
+    if (delay_name[0]) {
+        for (i = 0; i < DELAY_COUNT; i++) {
+            if (!strcmp(delay_name, delays[i].name)) {
+                break;
+            }
+        }
+        if (i == DELAY_COUNT) {
+            tw_error(TW_LOC, "Unknown delay distribution %s", delay_name);
+        }
+        delay = i;
+    }
+    strcpy(delay_name, delays[delay].name);
+
+    if (delay == DELAY_PARETO) {
+        if (shape <= 1.0) {
+            tw_error(TW_LOC, "Pareto shape must be above 1 for a finite mean");
+        }
+        delayScale = mean * (shape - 1.0) / shape;
+    }
+    if (delay == DELAY_WEIBULL) {
+        delayScale = mean / tgamma(1.0 + 1.0 / shape);
+    }
+    if (delay == DELAY_BIMODAL) {
+        if (bimodal_fraction < 0.0 || bimodal_fraction > 1.0 || bimodal_ratio <= 0.0) {
+            tw_error(TW_LOC, "Bimodal fraction must be between 0 and 1 and the ratio above 0");
+        }
+        delayScale = mean / (1.0 - bimodal_fraction + bimodal_fraction * bimodal_ratio);
+    }
+}
+
+void qhold_print_delay(void)
+{
+    printf("delay: %s", delay_name);
+    switch (delay) {
+    case DELAY_EXPONENTIAL:
+    case DELAY_TIES:
+        printf(" mean %lf", mean);
+        break;
+    case DELAY_BIMODAL:
+        printf(" mean %lf fraction %lf ratio %lf", mean, bimodal_fraction, bimodal_ratio);
+        break;
+    case DELAY_PARETO:
+    case DELAY_WEIBULL:
+        printf(" mean %lf shape %lf", mean, shape);
+        break;
+    }
+    printf(" population %u\n", population);
+}
+
+// Draws the delay to the next event, making delays[delay].rngCount RNG calls
+static tw_stime qhold_delay(tw_lp *lp)
+{
+    switch (delay) {
+    case DELAY_UNIFORM:
+        return tw_rand_ulong(lp->rng, 0, UINT_MAX-1);  // 32-bit
+    case DELAY_EXPONENTIAL:
+        return tw_rand_exponential(lp->rng, mean);
+    case DELAY_BIMODAL:
+        if (tw_rand_unif(lp->rng) < bimodal_fraction) {
+            return tw_rand_exponential(lp->rng, delayScale * bimodal_ratio);
+        }
+        return tw_rand_exponential(lp->rng, delayScale);
+    case DELAY_PARETO:
+        return delayScale / pow(tw_rand_unif(lp->rng), 1.0 / shape);
+    case DELAY_TIES:
+        return mean;
+    case DELAY_WEIBULL:
+        return delayScale * pow(-log(tw_rand_unif(lp->rng)), 1.0 / shape);
+    }
+    return 0;
+}
+
 // numerator and denominator of the fraction of events that should be sent away
 // from this LP; we represent the fraction this way to avoid floating point arithmetic
 unsigned int remoteFractNumerator = 1;
@@ -58,10 +215,10 @@ void qhold_init(q_state *s, tw_lp *lp)
         tw_lpid dest;
         q_message *newData;
         tw_event *newEvent;
-        unsigned nextEventDelay;
+        tw_stime nextEventDelay;
 
 		/* Calculate next event time */
-		nextEventDelay = tw_rand_ulong(lp->rng, 0, UINT_MAX-1);  	// 32-bit
+		nextEventDelay = qhold_delay(lp);
 
 		/* Calculate next event destination */
 		//dest = randomUnsignedLongInt(seed) mod nLPs; 		// 64-bit; send to all destinations uniformly
@@ -88,7 +245,7 @@ void qhold_event(q_state *s, tw_bf *bf, q_message *msg, tw_lp *lp)
     tw_lpid dest;
     q_message *newData;
     tw_event *newEvent;
-    unsigned nextEventDelay;
+    tw_stime nextEventDelay;
     unsigned long int random;
 
     // Zero out all of our bitfields and counters
@@ -114,8 +271,8 @@ void qhold_event(q_state *s, tw_bf *bf, q_message *msg, tw_lp *lp)
     globalHash += s->stateValue;
 
     /* Calculate next event time */
-    // 2 rng
-	nextEventDelay = tw_rand_ulong(lp->rng, 0, UINT_MAX-1);  // 32-bit
+    // 2 rng, delays[delay].rngCount calls
+	nextEventDelay = qhold_delay(lp);
 	if ( nextEventDelay == 0 ) {
         bf->c1 = 1;
         // if much more or less often that 1 in 2**32, we have a bad RNG
@@ -161,7 +318,7 @@ void qhold_event(q_state *s, tw_bf *bf, q_message *msg, tw_lp *lp)
 // Reverse event handler
 void qhold_event_reverse(q_state *s, tw_bf *bf, q_message *msg, tw_lp *lp)
 {
-    unsigned i;
+    int i;
 
     s->lastvtime = msg->RC.lastvtime;
 
@@ -183,7 +340,9 @@ void qhold_event_reverse(q_state *s, tw_bf *bf, q_message *msg, tw_lp *lp)
     }
 
     // 2
-    tw_rand_reverse_unif(lp->rng);
+    for (i = 0; i < delays[delay].rngCount; i++) {
+        tw_rand_reverse_unif(lp->rng);
+    }
 
     globalHash -= s->stateValue;
     s->stateValue = msg->RC.oldStateValue;
@@ -10,6 +10,12 @@ const tw_optdef qhold_opts[] = {
     TWOPT_ULONG("RSV", randomSeedVariation, "Random seed variation"),
     TWOPT_STIME("remote", percent_remote, "desired remote event rate"),
     TWOPT_UINT("memory", optimistic_memory, "additional memory buffers"),
+    TWOPT_CHAR("delay", delay_name, "delay distribution: uniform, exponential, bimodal, pareto, ties or weibull"),
+    TWOPT_STIME("mean", mean, "mean delay (exponential, bimodal, pareto, weibull) or the constant delay (ties), uniform ignores it"),
+    TWOPT_STIME("shape", shape, "shape of the pareto (above 1) and weibull delays"),
+    TWOPT_STIME("bimodal_fraction", bimodal_fraction, "fraction of long bimodal delays"),
+    TWOPT_STIME("bimodal_ratio", bimodal_ratio, "mean of long bimodal delays over mean of short ones"),
+    TWOPT_CHAR("preset", preset_name, "queue-stress profile, sets the defaults of delay, mean, shape and population: classic, large, bimodal, heavy, ties or weibull"),
 	TWOPT_END(),
 };
 
@@ -22,8 +28,11 @@ int qhold_main(int argc, char *argv[])
     int i;
     
 	tw_opt_add(qhold_opts);
+    qhold_preset(argc, argv);
 	tw_init(&argc, &argv);
     
+    qhold_configure();
+
     if (nlp_per_pe < 1) {
         nlp_per_pe = 1;
     }
@@ -66,13 +75,15 @@ int qhold_main(int argc, char *argv[])
         /* Main output */
 		//output globalHash, globalEvents, globalEventsScheduled, globalTies, globalZeroDelays;
         printf("\n\nStatistics:\n");
+        qhold_print_delay();
         printf("globalHash: %lu\n", globalHashR);
         printf("globalEvents: %lu\n", globalEventsR);
         printf("globalEventsScheduled: %lu\n", globalEventsScheduledR);
         printf("globalTies: %lu\n", globalTiesR);
         printf("globalZeroDelays: %lu\n", globalZeroDelaysR);
         
-        if (globalTiesR > 0) {
+        // constant delays tie on purpose
+        if (globalTiesR > 0 && delay != DELAY_TIES) {
             printf("*** Warning: globalTies > 0\n");
         }
         if (globalZeroDelaysR > 0) {
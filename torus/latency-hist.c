@@ -0,0 +1,47 @@
+#include "latency-hist.h"
+
+void
+latency_hist_add( double * hist,
+		  int bins,
+		  tw_stime width,
+		  tw_stime latency )
+{
+    int bin = latency / width;
+
+    if( bin >= bins )
+       bin = bins - 1;
+    hist[ bin ]++;
+}
+
+tw_stime
+latency_hist_percentile( const double * hist,
+			 int bins,
+			 tw_stime width,
+			 double count,
+			 double q,
+			 int * overflow )
+{
+    int i;
+    double sum = 0;
+
+    *overflow = 0;
+    if( count == 0 )
+       return 0;
+
+    for( i = 0; i < bins - 1; i++ )
+     {
+	sum += hist[ i ];
+	if( sum >= q * count )
+	   return ( i + 1 ) * width;
+     }
+    *overflow = 1;
+    return i * width;
+}
+
+void
+latency_hist_print( const char * name,
+		    tw_stime value,
+		    int overflow )
+{
+    printf( overflow ? " %s >=%lf" : " %s %lf", name, value );
+}
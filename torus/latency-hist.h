@@ -0,0 +1,21 @@
+#ifndef INC_latency_hist_h
+#define INC_latency_hist_h
+
+#include <ross.h>
+
+/* Fixed width latency histograms shared by the torus and dragonfly statistics. A histogram is a
+ * plain array of doubles, so it can sit inside a buffer that is reduced with MPI_SUM. Bin i
+ * counts latencies in [i*width, (i+1)*width), the last bin also counts all longer latencies. */
+
+void latency_hist_add( double * hist, int bins, tw_stime width, tw_stime latency );
+
+/* the q quantile (0 < q <= 1) of a histogram of count samples, as the upper edge of the bin that
+ * holds it. A quantile in the last bin has no upper edge: the lower edge of that bin is returned
+ * and *overflow is set, the quantile is then only known to be at least that value. */
+tw_stime latency_hist_percentile( const double * hist, int bins, tw_stime width, double count,
+				  double q, int * overflow );
+
+/* prints " name value", or " name >=value" for a percentile in the last bin */
+void latency_hist_print( const char * name, tw_stime value, int overflow );
+
+#endif
@@ -0,0 +1,152 @@
+#include "torus-stats.h"
+
+#define STATS_COLUMNS 13
+
+static torus_stats_point * stats_series = NULL;
+static int stats_points = 0;
+static tw_stime stats_end_time;
+static tw_stime stats_latency_bin;
+static tw_stime stats_max_latency = 0;
+
+void
+torus_stats_init( int n_points,
+		  tw_stime end_time,
+		  tw_stime latency_bin )
+{
+    stats_points = n_points;
+    stats_end_time = end_time;
+    stats_latency_bin = latency_bin;
+    stats_series = tw_calloc(TW_LOC, "torus stats", sizeof(torus_stats_point), n_points);
+}
+
+/* sample interval of time t, committed events are always before the end time */
+static torus_stats_point *
+stats_point( tw_stime t )
+{
+    int index = floor( stats_points * ( t / stats_end_time ) );
+
+    if( index >= stats_points )
+       index = stats_points - 1;
+    return &stats_series[ index ];
+}
+
+void
+torus_stats_generated( tw_stime t )
+{
+    stats_point( t )->generated++;
+}
+
+void
+torus_stats_finished( tw_stime t,
+		      tw_stime latency,
+		      int hops )
+{
+    torus_stats_point * p = stats_point( t );
+
+    p->finished++;
+    p->hops += hops;
+    p->latency_sum += latency;
+    latency_hist_add( p->latency_hist, STATS_LATENCY_BINS, stats_latency_bin, latency );
+
+    if( stats_max_latency < latency )
+       stats_max_latency = latency;
+}
+
+void
+torus_stats_queue_depth( tw_stime t,
+			 unsigned int depth )
+{
+    stats_point( t )->queue_depth += depth;
+}
+
+torus_stats_point *
+torus_stats_reduce( tw_stime * max_latency )
+{
+    torus_stats_point * total = NULL;
+
+    /* every field of a point is a double, so the whole series goes in one reduction */
+    if( tw_ismaster() )
+       total = tw_calloc(TW_LOC, "torus stats", sizeof(torus_stats_point), stats_points);
+
+    MPI_Reduce( stats_series, total, stats_points * sizeof(torus_stats_point) / sizeof(double),
+		MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD );
+    MPI_Reduce( &stats_max_latency, max_latency, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD );
+
+    return total;
+}
+
+tw_stime
+torus_stats_percentile( const torus_stats_point * p,
+			double q,
+			int * overflow )
+{
+    return latency_hist_percentile( p->latency_hist, STATS_LATENCY_BINS, stats_latency_bin,
+				    p->finished, q, overflow );
+}
+
+void
+torus_stats_print_percentile( const char * name,
+			      const torus_stats_point * p,
+			      double q )
+{
+    int overflow;
+    tw_stime value = torus_stats_percentile( p, q, &overflow );
+
+    latency_hist_print( name, value, overflow );
+}
+
+void
+torus_stats_write( const char * file,
+		   int binary,
+		   const torus_stats_point * series,
+		   int packet_size )
+{
+    int i, j, overflow[ 3 ];
+    int columns = STATS_COLUMNS;
+    double row[ STATS_COLUMNS ];
+    tw_stime interval = stats_end_time / stats_points;
+    FILE * f = fopen( file, binary ? "wb" : "w" );
+
+    if( !f )
+      {
+	printf("\n Cannot open statistics file %s ", file);
+	return;
+      }
+
+    if( binary )
+      {
+	fwrite( &stats_points, sizeof(int), 1, f );
+	fwrite( &columns, sizeof(int), 1, f );
+      }
+    else
+	fprintf( f, "time,generated,finished,throughput_GBps,avg_hops,queue_depth,avg_latency,p50_latency,p90_latency,p99_latency,p50_overflow,p90_overflow,p99_overflow\n" );
+
+    for( i = 0; i < stats_points; i++ )
+      {
+	const torus_stats_point * p = &series[ i ];
+
+	row[ 0 ] = i * interval;
+	row[ 1 ] = p->generated;
+	row[ 2 ] = p->finished;
+	/* bytes per nanosecond is GB/s */
+	row[ 3 ] = p->finished * packet_size / interval;
+	row[ 4 ] = p->finished ? p->hops / p->finished : 0;
+	row[ 5 ] = p->queue_depth;
+	row[ 6 ] = p->finished ? p->latency_sum / p->finished : 0;
+	row[ 7 ] = torus_stats_percentile( p, 0.50, &overflow[ 0 ] );
+	row[ 8 ] = torus_stats_percentile( p, 0.90, &overflow[ 1 ] );
+	row[ 9 ] = torus_stats_percentile( p, 0.99, &overflow[ 2 ] );
+	for( j = 0; j < 3; j++ )
+	   row[ 10 + j ] = overflow[ j ];
+
+	if( binary )
+	   fwrite( row, sizeof(double), columns, f );
+	else
+	  {
+	    for( j = 0; j < columns; j++ )
+	       fprintf( f, j ? ",%lf" : "%lf", row[ j ] );
+	    fprintf( f, "\n" );
+	  }
+      }
+    fclose( f );
+}
@@ -0,0 +1,51 @@
+#ifndef INC_torus_stats_h
+#define INC_torus_stats_h
+
+#include <ross.h>
+#include "latency-hist.h"
+
+/* Time series statistics of the torus model. Samples are only recorded from commit
+ * handlers, so rolled back events never count and nothing has to be undone by hand.
+ * Every PE fills pre-sized buffers of one point per sample interval and
+ * torus_stats_reduce() sums all of them with a single reduction. */
+
+/* latency histogram of every sample interval, the last bin also counts all longer latencies */
+#define STATS_LATENCY_BINS 64
+
+typedef struct torus_stats_point torus_stats_point;
+
+struct torus_stats_point
+{
+  double generated;
+  double finished;
+  double hops;
+  /* buffer occupancy of the destination nodes when packets are delivered, in chunks */
+  double queue_depth;
+  double latency_sum;
+  double latency_hist[STATS_LATENCY_BINS];
+};
+
+/* n_points intervals over [0, end_time), latencies are binned latency_bin wide */
+void torus_stats_init( int n_points, tw_stime end_time, tw_stime latency_bin );
+
+void torus_stats_generated( tw_stime t );
+void torus_stats_finished( tw_stime t, tw_stime latency, int hops );
+void torus_stats_queue_depth( tw_stime t, unsigned int depth );
+
+/* sums the series of all PEs, returns it on the master (NULL elsewhere) together with
+ * the global maximum latency */
+torus_stats_point * torus_stats_reduce( tw_stime * max_latency );
+
+/* the q quantile (0 < q <= 1) of the latencies of a point, see latency_hist_percentile() */
+tw_stime torus_stats_percentile( const torus_stats_point * p, double q, int * overflow );
+
+/* prints the q quantile of a point as " name value" or " name >=value" */
+void torus_stats_print_percentile( const char * name, const torus_stats_point * p, double q );
+
+/* writes one row per interval: start time, generated and finished packets, throughput in GB/s,
+ * average hops, queue depth, average latency, the 50/90/99th latency percentiles and one flag
+ * per percentile that is 1 when it lies in the last histogram bin and is only a lower bound, as
+ * CSV or as a binary file of an int row count, an int column count and rows of doubles. */
+void torus_stats_write( const char * file, int binary, const torus_stats_point * series, int packet_size );
+
+#endif
@@ -0,0 +1,101 @@
+/* Builds a binary torus trace from a text trace with one send per line:
+ *   rank time dest bytes
+ * Lines starting with # are skipped. Usage: torus-trace-convert trace.txt trace.bin */
+#include <stdio.h>
+#include <stdlib.h>
+#include "torus-trace.h"
+
+typedef struct
+{
+  unsigned int rank;
+  torus_trace_record rec;
+} trace_line;
+
+static int
+line_cmp( const void * a, const void * b )
+{
+    const trace_line * x = a, * y = b;
+
+    if( x->rank != y->rank )
+       return x->rank < y->rank ? -1 : 1;
+    if( x->rec.time != y->rec.time )
+       return x->rec.time < y->rec.time ? -1 : 1;
+    return 0;
+}
+
+int
+main( int argc, char ** argv )
+{
+    FILE * in, * out;
+    char buf[ 256 ];
+    trace_line * lines = NULL;
+    long n = 0, cap = 0, i;
+    unsigned int ranks = 0, r;
+    unsigned int header[ 4 ];
+    unsigned long long offset;
+
+    if( argc != 3 )
+      {
+	fprintf( stderr, "usage: %s trace.txt trace.bin\n", argv[ 0 ] );
+	return 1;
+      }
+
+    if( !( in = fopen( argv[ 1 ], "r" ) ) )
+      {
+	perror( argv[ 1 ] );
+	return 1;
+      }
+
+    while( fgets( buf, sizeof(buf), in ) )
+      {
+	trace_line l;
+
+	if( buf[ 0 ] == '#' || buf[ 0 ] == '\n' )
+	   continue;
+	if( sscanf( buf, "%u %lf %u %u", &l.rank, &l.rec.time, &l.rec.dest, &l.rec.bytes ) != 4 )
+	  {
+	    fprintf( stderr, "bad trace line: %s", buf );
+	    return 1;
+	  }
+	if( n == cap )
+	  {
+	    cap = cap ? 2 * cap : 1024;
+	    lines = realloc( lines, cap * sizeof(trace_line) );
+	  }
+	lines[ n++ ] = l;
+	if( l.rank >= ranks )
+	   ranks = l.rank + 1;
+	if( l.rec.dest >= ranks )
+	   ranks = l.rec.dest + 1;
+      }
+    fclose( in );
+
+    qsort( lines, n, sizeof(trace_line), line_cmp );
+
+    if( !( out = fopen( argv[ 2 ], "wb" ) ) )
+      {
+	perror( argv[ 2 ] );
+	return 1;
+      }
+
+    header[ 0 ] = TORUS_TRACE_MAGIC;
+    header[ 1 ] = TORUS_TRACE_VERSION;
+    header[ 2 ] = ranks;
+    header[ 3 ] = 0;
+    fwrite( header, sizeof(header), 1, out );
+
+    for( r = 0, i = 0; r <= ranks; r++ )
+      {
+	while( i < n && lines[ i ].rank < r )
+	   i++;
+	offset = i;
+	fwrite( &offset, sizeof(offset), 1, out );
+      }
+
+    for( i = 0; i < n; i++ )
+       fwrite( &lines[ i ].rec, sizeof(torus_trace_record), 1, out );
+
+    fclose( out );
+    printf( "%ld sends of %u ranks written to %s\n", n, ranks, argv[ 2 ] );
+    return 0;
+}
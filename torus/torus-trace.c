@@ -0,0 +1,117 @@
+#include <ross.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "torus-trace.h"
+
+static unsigned char * trace_map = NULL;
+static size_t trace_size;
+static unsigned int trace_ranks;
+static const unsigned long long * trace_index;
+static const torus_trace_record * trace_records;
+static long trace_page;
+
+int
+torus_trace_open( const char * file,
+		  unsigned int n_dests )
+{
+    unsigned long long i;
+    int fd;
+    struct stat st;
+    const unsigned int * header;
+
+    fd = open( file, O_RDONLY );
+    if( fd < 0 || fstat( fd, &st ) != 0 )
+       tw_error(TW_LOC, "\n Cannot open trace %s ", file);
+
+    trace_size = st.st_size;
+    if( trace_size < 4 * sizeof(unsigned int) )
+       tw_error(TW_LOC, "\n Trace %s is too short ", file);
+
+    trace_map = mmap( NULL, trace_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( trace_map == MAP_FAILED )
+       tw_error(TW_LOC, "\n Cannot map trace %s ", file);
+
+    header = (const unsigned int *) trace_map;
+    if( header[ 0 ] != TORUS_TRACE_MAGIC || header[ 1 ] != TORUS_TRACE_VERSION )
+       tw_error(TW_LOC, "\n %s is not a torus trace ", file);
+
+    trace_ranks = header[ 2 ];
+    trace_index = (const unsigned long long *)( trace_map + 4 * sizeof(unsigned int) );
+    trace_records = (const torus_trace_record *)( trace_index + trace_ranks + 1 );
+
+    if( (unsigned char *)( trace_records + trace_index[ trace_ranks ] ) > trace_map + trace_size )
+       tw_error(TW_LOC, "\n Trace %s is truncated ", file);
+
+    for( i = 0; i < trace_index[ trace_ranks ]; i++ )
+       if( trace_records[ i ].dest >= n_dests )
+	  tw_error(TW_LOC, "\n Send %llu of trace %s goes to rank %u, there are only %u ranks ",
+		   i, file, trace_records[ i ].dest, n_dests);
+
+    trace_page = sysconf( _SC_PAGESIZE );
+
+    /* records are read in order per rank, read-ahead only pays off within a window, and
+       nothing stays resident from the check above */
+    madvise( trace_map, trace_size, MADV_RANDOM );
+    madvise( trace_map, trace_size, MADV_DONTNEED );
+    return trace_ranks;
+}
+
+long
+torus_trace_count( int rank )
+{
+    if( !trace_map || rank < 0 || (unsigned int) rank >= trace_ranks )
+       return 0;
+    return trace_index[ rank + 1 ] - trace_index[ rank ];
+}
+
+/* page aligned madvise over the records [first, first + count) of a rank */
+static void
+trace_advise( int rank,
+	      long first,
+	      long count,
+	      int advice )
+{
+    unsigned char * start, * end;
+
+    if( first + count > torus_trace_count( rank ) )
+       count = torus_trace_count( rank ) - first;
+    if( count <= 0 )
+       return;
+
+    start = (unsigned char *)( trace_records + trace_index[ rank ] + first );
+    end = (unsigned char *)( trace_records + trace_index[ rank ] + first + count );
+    start -= ( start - trace_map ) % trace_page;
+
+    madvise( start, end - start, advice );
+}
+
+const torus_trace_record *
+torus_trace_record_at( int rank,
+		       long i )
+{
+    if( i % TRACE_WINDOW == 0 )
+       trace_advise( rank, i, TRACE_WINDOW, MADV_WILLNEED );
+
+    return &trace_records[ trace_index[ rank ] + i ];
+}
+
+void
+torus_trace_release( int rank,
+		     long i )
+{
+    /* the mapping is read-only, a dropped page is read again from the file if a
+       neighbouring rank still needs it */
+    if( ( i + 1 ) % TRACE_WINDOW == 0 )
+       trace_advise( rank, i + 1 - TRACE_WINDOW, TRACE_WINDOW, MADV_DONTNEED );
+}
+
+void
+torus_trace_close( void )
+{
+    if( trace_map )
+       munmap( trace_map, trace_size );
+    trace_map = NULL;
+}
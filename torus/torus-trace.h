@@ -0,0 +1,43 @@
+#ifndef INC_torus_trace_h
+#define INC_torus_trace_h
+
+/* Trace of MPI sends replayed by the MPI process LPs (--trace=FILE). The binary file is
+ *   header:  uint32 magic TORUS_TRACE_MAGIC, uint32 version, uint32 number of ranks, uint32 0
+ *   index:   uint64 first record of every rank and the total record count (ranks + 1 values)
+ *   records: torus_trace_record, grouped by rank and sorted by time within a rank
+ * and is mapped read-only, only the window of records around the cursor of each rank is
+ * paged in. torus-trace-convert builds it from a text trace. */
+#define TORUS_TRACE_MAGIC 0x43525454
+#define TORUS_TRACE_VERSION 1
+
+/* records are paged in and dropped TRACE_WINDOW records at a time */
+#define TRACE_WINDOW 4096
+
+typedef struct torus_trace_record torus_trace_record;
+
+struct torus_trace_record
+{
+  /* send time in ns */
+  double time;
+  /* destination MPI rank */
+  unsigned int dest;
+  /* message size in bytes */
+  unsigned int bytes;
+};
+
+/* maps the trace file, returns the number of ranks in it. Every destination is checked to be
+ * below n_dests, which reads the whole file once */
+int torus_trace_open( const char * file, unsigned int n_dests );
+
+/* number of sends of a rank, 0 for ranks beyond the trace */
+long torus_trace_count( int rank );
+
+/* i-th send of a rank, prefetches the next window when i starts a window */
+const torus_trace_record * torus_trace_record_at( int rank, long i );
+
+/* the i-th send of a rank has committed, the window it ends is dropped from memory */
+void torus_trace_release( int rank, long i );
+
+void torus_trace_close( void );
+
+#endif
@@ -17,10 +17,96 @@ getProcID( tw_lpid lpid )
 	  return lpid - N_nodes;
 }
 
+/* Splits a box of length[] nodes into parts near-cubic blocks: every prime factor of parts,
+ * largest first, goes to the dimension with the longest block that it divides.
+ * Returns 0 if parts does not factor over the box. */
+int
+torus_block_split( const int * length,
+		   int * count,
+		   int parts )
+{
+    int i, p, best;
+    int primes[64], n_primes = 0;
+
+    for( i = 0; i < N_dims; i++ )
+       count[ i ] = 1;
+
+    for( p = 2; parts > 1; p++ )
+       while( parts % p == 0 && n_primes < 64 )
+	 {
+	   primes[ n_primes++ ] = p;
+	   parts /= p;
+	 }
+
+    while( n_primes-- > 0 )
+     {
+       p = primes[ n_primes ];
+       best = -1;
+
+       for( i = 0; i < N_dims; i++ )
+	  if( ( length[ i ] / count[ i ] ) % p == 0 &&
+	      ( best < 0 || length[ i ] / count[ i ] > length[ best ] / count[ best ] ) )
+	     best = i;
+
+       if( best < 0 )
+	  return 0;
+
+       count[ best ] *= p;
+     }
+    return 1;
+}
+
+/* In the block mapping each rank owns a block of block_length[] nodes, returns the rank of a node */
+tw_peid
+block_rank( tw_lpid node )
+{
+    int i;
+    tw_peid rank = 0;
+    const unsigned char * c = torus_coords( node );
+
+    for( i = N_dims - 1; i >= 0; i-- )
+       rank = rank * block_count[ i ] + c[ i ] / block_length[ i ];
+
+    return rank;
+}
+
+/* Position of a node inside the block of its rank, used as its local LP index */
+int
+block_offset( tw_lpid node )
+{
+    int i, offset = 0;
+    const unsigned char * c = torus_coords( node );
+
+    for( i = N_dims - 1; i >= 0; i-- )
+       offset = offset * block_length[ i ] + c[ i ] % block_length[ i ];
+
+    return offset;
+}
+
+/* KP of a node inside the block of its rank, the block is cut again into kp_count[] sub-blocks */
+tw_kpid
+block_kp( tw_lpid node )
+{
+    int i;
+    tw_kpid kp = 0;
+    const unsigned char * c = torus_coords( node );
+
+    if( !kp_blocks )
+       return (tw_kpid)block_offset( node ) * g_tw_nkp / nlp_nodes_per_pe;
+
+    for( i = N_dims - 1; i >= 0; i-- )
+       kp = kp * kp_count[ i ] + ( c[ i ] % block_length[ i ] ) / ( block_length[ i ] / kp_count[ i ] );
+
+    return kp;
+}
+
 /*Takes a MPI LP id and a torus node LP ID, returns the process ID on which the lp is mapped */
 tw_peid
 mapping( tw_lpid gid )
 {
+    if( block_mapping )
+       return block_rank( gid < N_nodes ? gid : getProcID( gid ) );
+
     int rank;
     int offset;
     int is_rank = 0;
@@ -56,156 +142,579 @@ mapping( tw_lpid gid )
     return rank;
 }
 
-/*Initialize the torus model, this initialization part is borrowed from Ning's torus model */
+/* parses a comma separated list of dimension lengths, returns the number of dimensions */
+int
+parse_dims( const char * str,
+	    int * length )
+{
+    int n = 0;
+    const char * p = str;
+    char * end;
+
+    while( *p )
+     {
+	if( n >= MAX_DIMS )
+	   tw_error(TW_LOC, "\n At most %d torus dimensions are supported: %s ", MAX_DIMS, str);
+
+	length[ n ] = strtol( p, &end, 10 );
+	if( end == p || length[ n ] < 1 || length[ n ] > 255 )
+	   tw_error(TW_LOC, "\n Invalid torus dimensions %s ", str);
+
+	n++;
+	p = end;
+	if( *p == ',' )
+	   p++;
+     }
+    return n;
+}
+
+/* returns the lpID of the neighbor of a node one step along dim in direction dir (0 minus, 1 plus) */
+tw_lpid
+torus_neighbour( tw_lpid gid,
+		 const unsigned char * position,
+		 const int * length,
+		 const int * fact,
+		 int dim,
+		 int dir )
+{
+    int next = ( position[ dim ] + ( dir ? 1 : -1 ) + length[ dim ] ) % length[ dim ];
+
+    return gid + ( next - position[ dim ] ) * fact[ dim ];
+}
+
+/* Builds the per-PE lookup tables once, so that neither the LP initialization nor the
+ * routing has to turn lpIDs into torus coordinates by repeated div/mod */
 void
-torus_init( nodes_state * s,
-	   tw_lp * lp )
+torus_setup()
 {
     int i, j;
+    long n;
+
+    factor[ 0 ] = 1;
+    factor_sim[ 0 ] = 1;
+
+    /* factor helps in calculating the neighbors of the torus */
+    for ( i = 0; i < N_dims; i++ )
+      {
+	if( i > 0 )
+	   factor[ i ] = factor[ i - 1 ] * dim_length[ i - 1 ];
+	half_length[ i ] = dim_length[ i ] / 2;
+      }
 
-    /* contains the real torus dimension coordinates */
-    int dim_N[ N_dims + 1 ];
-    int dim_N_sim[N_dims_sim + 1];
+    /* factor helps in calculating neighbors of the simulated torus */
+    for ( i = 0; i < N_dims_sim; i++ )
+      {
+	if( i > 0 )
+	   factor_sim[ i ] = factor_sim[ i - 1 ] * dim_length_sim[ i - 1 ];
+	half_length_sim[ i ] = dim_length_sim[ i ] / 2;
+      }
 
-    /* initialize the real torus dimension */
-    dim_N[ 0 ]=( int )lp->gid;
+    coord_table = tw_calloc(TW_LOC, "torus coordinates", N_dims, N_nodes);
+    coord_table_sim = tw_calloc(TW_LOC, "simulated torus coordinates", N_dims_sim, N_nodes);
 
-    /* initialize the simulated torus dimension */
-    dim_N_sim[0]=(int)lp->gid;
+    /* walk the lpIDs in order and carry the coordinates like an odometer */
+    for ( n = 1; n < N_nodes; n++ )
+      {
+	memcpy( torus_coords( n ), torus_coords( n - 1 ), N_dims );
+	for ( i = 0; i < N_dims && ++torus_coords( n )[ i ] == dim_length[ i ]; i++ )
+	   torus_coords( n )[ i ] = 0;
 
-  /* calculate the LP's real torus co-ordinates */
-  for ( i=0; i < N_dims; i++ )
-    {
-      s->dim_position[ i ] = dim_N[ i ]%dim_length[ i ];
-      dim_N[ i + 1 ] = ( dim_N[ i ] - s->dim_position[ i ] )/dim_length[ i ];
+	memcpy( torus_coords_sim( n ), torus_coords_sim( n - 1 ), N_dims_sim );
+	for ( j = 0; j < N_dims_sim && ++torus_coords_sim( n )[ j ] == dim_length_sim[ j ]; j++ )
+	   torus_coords_sim( n )[ j ] = 0;
+      }
 
-      half_length[ i ] = dim_length[ i ] / 2;
-    }
+    neighbour_table = tw_calloc(TW_LOC, "torus neighbors", sizeof(tw_lpid), 2 * N_dims * nlp_nodes_per_pe);
+    neighbour_table_sim = tw_calloc(TW_LOC, "simulated torus neighbors", sizeof(tw_lpid), 2 * N_dims_sim * nlp_nodes_per_pe);
+}
 
-  /* calculate the LP's simulated torus dimensions */
-  for ( i=0; i < N_dims_sim; i++ )
-    {
-      s->dim_position_sim[ i ] = dim_N_sim[ i ]%dim_length_sim[ i ];
-      dim_N_sim[ i + 1 ] = ( dim_N_sim[ i ] - s->dim_position_sim[ i ] )/dim_length_sim[ i ];
+/* Fraction of torus links whose two ends are mapped on different ranks, this is the expected
+ * fraction of remote ARRIVAL and CREDIT events when every link carries the same load */
+double
+remote_link_fraction( int block )
+{
+    long n, remote = 0, total = 0;
+    int i, dir;
+    tw_lpid nbr;
+    int nodes_per_rank = N_nodes / tw_nnodes();
 
-      half_length_sim[ i ] = dim_length_sim[ i ] / 2;
-    }
+    for( n = 0; n < N_nodes; n++ )
+      for( i = 0; i < N_dims; i++ )
+	for( dir = 0; dir < 2; dir++ )
+	  {
+	    nbr = torus_neighbour( n, torus_coords( n ), dim_length, factor, i, dir );
+	    total++;
 
-  factor[ 0 ] = 1;
-  factor_sim[0] = 1;
+	    if( block )
+	       remote += block_rank( n ) != block_rank( nbr );
+	    else
+	       remote += n / nodes_per_rank != nbr / nodes_per_rank;
+	  }
+    return (double)remote / total;
+}
 
-  /* factor helps in calculating the neighbors of the torus */
-  for ( i=1; i < N_dims; i++ )
-    {
-      factor[ i ] = 1;
-      for ( j = 0; j < i; j++ )
-        factor[ i ] *= dim_length[ j ];
-    }
+/* Takes a record from the per-PE slab, growing the slab when it runs dry */
+waiting_packet *
+waiting_packet_alloc()
+{
+   int i;
+   waiting_packet * w;
 
-  /* factor helps in calculating neighbors of the simulated torus */
-  for ( i=1; i < N_dims_sim; i++ )
+   if(!waiting_free_list)
     {
-      factor_sim[ i ] = 1;
-      for ( j = 0; j < i; j++ )
-        factor_sim[ i ] *= dim_length_sim[ j ];
+      w = tw_calloc(TW_LOC, "waiting packet slab", sizeof(struct waiting_packet), WAITING_SLAB_SIZE);
+
+      for(i = 0; i < WAITING_SLAB_SIZE - 1; i++)
+	w[i].next = &w[i + 1];
+
+      w[i].next = NULL;
+      waiting_free_list = w;
+      waiting_slab_records += WAITING_SLAB_SIZE;
     }
+   w = waiting_free_list;
+   waiting_free_list = w->next;
+   w->next = NULL;
+   w->prev = NULL;
+   return w;
+}
 
-  int temp_dim_plus_pos[ N_dims ], temp_dim_plus_pos_sim[ N_dims_sim ];
-  int temp_dim_minus_pos[ N_dims ], temp_dim_minus_pos_sim[ N_dims_sim ];
+/* Returns a record to the per-PE slab */
+void
+waiting_packet_release(waiting_packet * w)
+{
+   w->prev = NULL;
+   w->next = waiting_free_list;
+   waiting_free_list = w;
+}
 
-  /* calculate neighbors of the torus dimension */
-  for ( i = 0; i < N_dims; i++ )
-  {
-    temp_dim_plus_pos[ i ] = s->dim_position[ i ];
-    temp_dim_minus_pos[ i ] = s->dim_position[ i ];
-  }
+/* Creates an event like tw_event_new, its destination and receive time are kept for
+   torus_event_send */
+tw_event *
+torus_event_new( tw_lpid dest,
+		 tw_stime offset,
+		 tw_lp * lp )
+{
+    ckpt_send_dest = dest;
+    ckpt_send_time = tw_now( lp ) + offset;
+    return tw_event_new( dest, offset, lp );
+}
 
-  /* calculated neighbors of the simulated torus */
-  for ( i = 0; i < N_dims_sim; i++ )
-  {
-    temp_dim_plus_pos_sim[ i ] = s->dim_position_sim[ i ];
-    temp_dim_minus_pos_sim[ i ] = s->dim_position_sim[ i ];
-  }
+/* Sends an event made by torus_event_new. An event sent before the checkpoint of its sender that
+   arrives at or after the checkpoint time is in flight, it is copied and belongs to the event
+   that sent it until that one commits. Events sent by an init handler never roll back. */
+void
+torus_event_send( tw_event * e )
+{
+    nodes_message * m = tw_event_data( e );
+    torus_ckpt * c = ckpt_current;
+    ckpt_event * p;
 
-  if( lp->gid == TRACK_LP )
-  {
-    printf("\n LP %d assigned dimensions: ", (int)lp->gid);
+    if( checkpoint_prefix[0] && !c->taken && ckpt_send_time >= checkpoint_time && m->type != CHECKPOINT )
+      {
+	p = malloc( sizeof(ckpt_event) );
+	p->dest = ckpt_send_dest;
+	p->recv_time = ckpt_send_time;
+	p->msg = *m;
+	p->cause = ckpt_cause;
 
-    for( i = 0; i < N_dims_sim; i++ )
-        printf(" %d ", s->dim_position_sim[ i ]);
+	if( !ckpt_cause )
+	  {
+	    p->next = c->in_flight;
+	    c->in_flight = p;
+	  }
+	else
+	  {
+	    p->prev = c->sent_tail;
+	    p->next = NULL;
+	    if( c->sent_tail )
+	       c->sent_tail->next = p;
+	    else
+	       c->sent_head = p;
+	    c->sent_tail = p;
+	  }
+      }
+    tw_event_send( e );
+}
 
-    printf("\t ");
+/* appends size bytes to a checkpoint image */
+void
+ckpt_put( torus_ckpt * c,
+	  long * capacity,
+	  const void * data,
+	  long size )
+{
+    if( c->image_size + size > *capacity )
+      {
+	*capacity = ROSS_MAX( 2 * *capacity, c->image_size + size );
+	c->image = realloc( c->image, *capacity );
+      }
+    memcpy( c->image + c->image_size, data, size );
+    c->image_size += size;
+}
 
-    for( i = 0; i < N_dims; i++ )
-        printf(" %d ", s->dim_position[ i ]);
-  }
+/* reads size bytes of a checkpoint record, returns the position after them */
+const char *
+ckpt_get( const char * p,
+	  void * data,
+	  long size )
+{
+    memcpy( data, p, size );
+    return p + size;
+}
 
-  /* calculate minus and plus neighbour's lpID */
-  for ( j = 0; j < N_dims; j++ )
-    {
-      temp_dim_plus_pos[ j ] = (s->dim_position[ j ] + 1 + dim_length[ j ]) % dim_length[ j ];
-      temp_dim_minus_pos[ j ] =  (s->dim_position[ j ] - 1 + dim_length[ j ]) % dim_length[ j ];
+/* copy of an MPI process without its checkpoint, which only holds pointers */
+mpi_process
+ckpt_mpi_image( const mpi_process * p )
+{
+    mpi_process copy = *p;
 
-      s->neighbour_minus_lpID[ j ] = 0;
-      s->neighbour_plus_lpID[ j ] = 0;
+    memset( &copy.ckpt, 0, sizeof(torus_ckpt) );
+    return copy;
+}
 
-      for ( i = 0; i < N_dims; i++ )
-       {
-        s->neighbour_minus_lpID[ j ] += factor[ i ] * temp_dim_minus_pos[ i ];
-	s->neighbour_plus_lpID[ j ] += factor[ i ] * temp_dim_plus_pos[ i ];
-       }
+/* Serializes a node LP, the waiting packets of every port are written in FIFO order
+   after the port so no pointer ends up in the image */
+void
+ckpt_take_node( nodes_state * s,
+		tw_lp * lp )
+{
+    int i;
+    long capacity = 0;
+    waiting_packet * w;
+    mpi_process mpi = ckpt_mpi_image( &s->mpi );
+
+    s->ckpt.image = NULL;
+    s->ckpt.image_size = 0;
+    ckpt_put( &s->ckpt, &capacity, &s->packet_counter, sizeof(s->packet_counter) );
+    ckpt_put( &s->ckpt, &capacity, &s->source_dim, sizeof(s->source_dim) );
+    ckpt_put( &s->ckpt, &capacity, &s->direction, sizeof(s->direction) );
+    ckpt_put( &s->ckpt, &capacity, &mpi, sizeof(mpi_process) );
+    ckpt_put( &s->ckpt, &capacity, lp->rng, sizeof(tw_rng_stream) );
+
+    for( i = 0; i < 2 * N_dims; i++ )
+      {
+	ckpt_put( &s->ckpt, &capacity, s->port[ i ].next_link_available_time, sizeof(tw_stime) * NUM_VC );
+	ckpt_put( &s->ckpt, &capacity, s->port[ i ].next_credit_available_time, sizeof(tw_stime) * NUM_VC );
+	ckpt_put( &s->ckpt, &capacity, s->port[ i ].buffer, sizeof(int) * NUM_VC );
+	ckpt_put( &s->ckpt, &capacity, &s->port[ i ].wait_count, sizeof(int) );
 
-      temp_dim_plus_pos[ j ] = s->dim_position[ j ];
-      temp_dim_minus_pos[ j ] = s->dim_position[ j ];
-    }
+	for( w = s->port[ i ].wait_head; w; w = w->next )
+	   ckpt_put( &s->ckpt, &capacity, &w->packet, sizeof(nodes_message) );
+      }
 
-  /* calculate minus and plus neighbour's lpID */
-  for ( j = 0; j < N_dims_sim; j++ )
-    {
-      temp_dim_plus_pos_sim[ j ] = (s->dim_position_sim[ j ] + 1 + dim_length_sim[ j ]) % dim_length_sim[ j ];
-      temp_dim_minus_pos_sim[ j ] =  (s->dim_position_sim[ j ] - 1 + dim_length_sim[ j ]) % dim_length_sim[ j ];
+    /* a combined LP takes the checkpoint of its MPI process as well */
+    s->ckpt.taken = 1;
+    s->mpi.ckpt.taken = 1;
+}
 
-      s->neighbour_minus_lpID_sim[ j ] = 0;
-      s->neighbour_plus_lpID_sim[ j ] = 0;
+void
+ckpt_take_mpi( mpi_process * p,
+	       tw_lp * lp )
+{
+    long capacity = 0;
+    mpi_process mpi = ckpt_mpi_image( p );
+
+    p->ckpt.image = NULL;
+    p->ckpt.image_size = 0;
+    ckpt_put( &p->ckpt, &capacity, &mpi, sizeof(mpi_process) );
+    ckpt_put( &p->ckpt, &capacity, lp->rng, sizeof(tw_rng_stream) );
+    p->ckpt.taken = 1;
+}
 
-      for ( i = 0; i < N_dims_sim; i++ )
-       {
-        s->neighbour_minus_lpID_sim[ j ] += factor_sim[ i ] * temp_dim_minus_pos_sim[ i ];
-	s->neighbour_plus_lpID_sim[ j ] += factor_sim[ i ] * temp_dim_plus_pos_sim[ i ];
-       }
+/* reverse of ckpt_take_node and ckpt_take_mpi */
+void
+ckpt_take_rc( torus_ckpt * c )
+{
+    free( c->image );
+    c->image = NULL;
+    c->image_size = 0;
+    c->taken = 0;
+}
 
-      temp_dim_plus_pos_sim[ j ] = s->dim_position_sim[ j ];
-      temp_dim_minus_pos_sim[ j ] = s->dim_position_sim[ j ];
-    }
+/* Called first by every event handler: the events in flight sent by msg belong to it, returns 1
+   if the LP has to take its checkpoint before handling msg */
+int
+ckpt_begin( torus_ckpt * c,
+	    nodes_message * msg,
+	    tw_lp * lp )
+{
+    ckpt_current = c;
+    ckpt_cause = msg;
+    msg->ckpt_taken = checkpoint_prefix[0] && !c->taken && tw_now( lp ) >= checkpoint_time;
+    return msg->ckpt_taken;
+}
 
-  for( j=0; j < 2 * N_dims; j++ )
-   {
-    for( i = 0; i < NUM_VC; i++ )
-     {
-       s->buffer[ j ][ i ] = 0;
-       s->next_link_available_time[ j ][ i ] = 0.0;
-     }
-   }
-  // record LP time
-    s->packet_counter = 0;
-    s->waiting_list = tw_calloc(TW_LOC, "waiting list", sizeof(struct waiting_packet), WAITING_PACK_COUNT);
+/* reverse of ckpt_begin, drops the events in flight sent by msg and the checkpoint it took. The
+   events of an LP roll back in reverse order, so the copies of msg are the newest ones */
+void
+ckpt_begin_rc( torus_ckpt * c,
+	       const nodes_message * msg )
+{
+    ckpt_event * p;
 
-    for (j = 0; j < WAITING_PACK_COUNT - 1; j++) {
-    s->waiting_list[j].next = &s->waiting_list[j + 1];
-    s->waiting_list[j].dim = -1;
-    s->waiting_list[j].dir = -1;
-    s->waiting_list[j].packet = NULL;
-    }
+    while( ( p = c->sent_tail ) && p->cause == msg )
+      {
+	c->sent_tail = p->prev;
+	if( p->prev )
+	   p->prev->next = NULL;
+	else
+	   c->sent_head = NULL;
+	free( p );
+      }
+
+    if( msg->ckpt_taken )
+       ckpt_take_rc( c );
+}
 
-    s->waiting_list[j].next = NULL;
-    s->waiting_list[j].dim = -1;
-    s->waiting_list[j].dir = -1;
-    s->waiting_list[j].packet = NULL;
+/* schedules the CHECKPOINT event of an LP, it makes sure the LP takes its checkpoint even if
+   nothing else reaches it at or after the checkpoint time */
+void
+ckpt_schedule( tw_lp * lp )
+{
+    tw_event * e;
+    nodes_message * m;
 
-    s->head = &s->waiting_list[0];
-    s->wait_count = 0;
+    if( !checkpoint_prefix[0] || checkpoint_time <= restart_time )
+       return;
 
+    e = torus_event_new( lp->gid, checkpoint_time - tw_now( lp ), lp );
+    m = tw_event_data( e );
+    m->type = CHECKPOINT;
+    torus_event_send( e );
 }
+
+/* writes the image and the events in flight of an LP to the checkpoint file of the rank and frees
+   them, the LP keeps counting as checkpointed */
+void
+ckpt_write( torus_ckpt * c,
+	    tw_lp * lp )
+{
+    long n = 0;
+    ckpt_event * p;
+
+    if( !c->image )
+       return;
+
+    /* events sent before the checkpoint that have not committed by the end of the run are part of it */
+    while( ( p = c->sent_head ) )
+      {
+	c->sent_head = p->next;
+	p->next = c->in_flight;
+	c->in_flight = p;
+      }
+    c->sent_tail = NULL;
+
+    for( p = c->in_flight; p; p = p->next )
+       n++;
+
+    fwrite( &lp->gid, sizeof(tw_lpid), 1, ckpt_file );
+    fwrite( &c->image_size, sizeof(long), 1, ckpt_file );
+    fwrite( c->image, 1, c->image_size, ckpt_file );
+    fwrite( &n, sizeof(long), 1, ckpt_file );
+
+    while( c->in_flight )
+      {
+	p = c->in_flight;
+	fwrite( &p->dest, sizeof(tw_lpid), 1, ckpt_file );
+	fwrite( &p->recv_time, sizeof(tw_stime), 1, ckpt_file );
+	fwrite( &p->msg, sizeof(nodes_message), 1, ckpt_file );
+	c->in_flight = p->next;
+	free( p );
+      }
+
+    free( c->image );
+    c->image = NULL;
+    c->image_size = 0;
+}
+
+/* Called by every commit handler: the events in flight sent by msg can no longer roll back. The
+   event that took the checkpoint commits after every earlier event of the LP, so its commit
+   writes the checkpoint of the LP */
+void
+ckpt_commit( torus_ckpt * c,
+	     const nodes_message * msg,
+	     tw_lp * lp )
+{
+    ckpt_event * p;
+
+    while( ( p = c->sent_head ) && p->cause == msg )
+      {
+	c->sent_head = p->next;
+	if( p->next )
+	   p->next->prev = NULL;
+	else
+	   c->sent_tail = NULL;
+	p->next = c->in_flight;
+	c->in_flight = p;
+      }
+
+    if( msg->ckpt_taken )
+       ckpt_write( c, lp );
+}
+
+/* header of the checkpoint files for the current configuration */
+ckpt_header
+ckpt_make_header( tw_stime time )
+{
+    ckpt_header h;
+
+    memset( &h, 0, sizeof(h) );
+    h.magic = CKPT_MAGIC;
+    h.version = CKPT_VERSION;
+    h.n_ranks = tw_nnodes();
+    h.N_dims = N_dims;
+    memcpy( h.dim_length, dim_length, sizeof(dim_length) );
+    h.wormhole = wormhole;
+    h.combined = combined_lp;
+    h.block_mapping = block_mapping;
+    h.message_size = sizeof(nodes_message);
+    h.time = time;
+    return h;
+}
+
+/* name of the checkpoint file of this rank */
+void
+ckpt_file_name( char * name,
+		const char * prefix )
+{
+    sprintf( name, "%s.%d", prefix, (int)g_tw_mynode );
+}
+
+/* Reads the checkpoint file of this rank, the restart continues at the checkpoint time */
+void
+ckpt_open_restart( void )
+{
+    char name[ 600 ];
+    FILE * f;
+    long size;
+    ckpt_header h, expect;
+
+    ckpt_file_name( name, restart_prefix );
+    if( !( f = fopen( name, "rb" ) ) )
+       tw_error(TW_LOC, "\n Cannot open checkpoint %s ", name);
+
+    fseek( f, 0, SEEK_END );
+    size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    ckpt_data = tw_calloc(TW_LOC, "checkpoint", 1, size + 1);
+    ckpt_data_size = size;
+    if( size < sizeof(ckpt_header) || fread( ckpt_data, 1, size, f ) != size )
+       tw_error(TW_LOC, "\n Cannot read checkpoint %s ", name);
+    fclose( f );
+
+    memcpy( &h, ckpt_data, sizeof(h) );
+    expect = ckpt_make_header( h.time );
+    if( memcmp( &h, &expect, sizeof(h) ) != 0 )
+       tw_error(TW_LOC, "\n Checkpoint %s was taken with another torus, mapping, granularity or number of ranks ", name);
+
+    restart_time = h.time;
+    ckpt_records = NULL;
+}
+
+/* checkpoint record of an LP, the records are indexed by local LP ID on first use */
+const char *
+ckpt_lookup( tw_lp * lp )
+{
+    const char * p, * record;
+    tw_lpid gid;
+    long size, n;
+
+    if( !ckpt_records )
+      {
+	ckpt_records = tw_calloc(TW_LOC, "checkpoint", sizeof(char *), g_tw_nlp);
+
+	for( p = ckpt_data + sizeof(ckpt_header); p < ckpt_data + ckpt_data_size; )
+	  {
+	    record = p;
+	    p = ckpt_get( p, &gid, sizeof(tw_lpid) );
+	    p = ckpt_get( p, &size, sizeof(long) );
+	    p = ckpt_get( p + size, &n, sizeof(long) );
+	    p += n * ( sizeof(tw_lpid) + sizeof(tw_stime) + sizeof(nodes_message) );
+
+	    if( mapping( gid ) != g_tw_mynode )
+	       tw_error(TW_LOC, "\n Checkpoint of LP %d does not belong to rank %d ", (int)gid, (int)g_tw_mynode);
+	    ckpt_records[ g_tw_custom_lp_global_to_local_map( gid )->id ] = record;
+	  }
+      }
+
+    if( !ckpt_records[ lp->id ] )
+       tw_error(TW_LOC, "\n No checkpoint of LP %d ", (int)lp->gid);
+
+    /* skip the lpID and the image size */
+    return ckpt_records[ lp->id ] + sizeof(tw_lpid) + sizeof(long);
+}
+
+/* re-sends the events an LP had in flight at the checkpoint */
+void
+ckpt_restore_events( const char * p,
+		     tw_lp * lp )
+{
+    long n;
+    tw_lpid dest;
+    tw_stime t;
+    tw_event * e;
+
+    p = ckpt_get( p, &n, sizeof(long) );
+    while( n-- > 0 )
+      {
+	p = ckpt_get( p, &dest, sizeof(tw_lpid) );
+	p = ckpt_get( p, &t, sizeof(tw_stime) );
+	e = torus_event_new( dest, t - tw_now( lp ), lp );
+	p = ckpt_get( p, tw_event_data( e ), sizeof(nodes_message) );
+	torus_event_send( e );
+      }
+}
+
+/* Restores a node LP from its checkpoint, torus_init has already set up its tables and ports */
+void
+ckpt_restore_node( nodes_state * s,
+		   tw_lp * lp )
+{
+    int i, k, n;
+    waiting_packet * w;
+    const char * p = ckpt_lookup( lp );
+
+    p = ckpt_get( p, &s->packet_counter, sizeof(s->packet_counter) );
+    p = ckpt_get( p, &s->source_dim, sizeof(s->source_dim) );
+    p = ckpt_get( p, &s->direction, sizeof(s->direction) );
+    p = ckpt_get( p, &s->mpi, sizeof(mpi_process) );
+    p = ckpt_get( p, lp->rng, sizeof(tw_rng_stream) );
+
+    for( i = 0; i < 2 * N_dims; i++ )
+      {
+	p = ckpt_get( p, s->port[ i ].next_link_available_time, sizeof(tw_stime) * NUM_VC );
+	p = ckpt_get( p, s->port[ i ].next_credit_available_time, sizeof(tw_stime) * NUM_VC );
+	p = ckpt_get( p, s->port[ i ].buffer, sizeof(int) * NUM_VC );
+	p = ckpt_get( p, &n, sizeof(int) );
+
+	/* rebuild the FIFO of waiting packets */
+	for( k = 0; k < n; k++ )
+	  {
+	    w = waiting_packet_alloc();
+	    p = ckpt_get( p, &w->packet, sizeof(nodes_message) );
+	    w->prev = s->port[ i ].wait_tail;
+	    if( s->port[ i ].wait_tail )
+	       s->port[ i ].wait_tail->next = w;
+	    else
+	       s->port[ i ].wait_head = w;
+	    s->port[ i ].wait_tail = w;
+	  }
+	s->port[ i ].wait_count = n;
+      }
+    ckpt_restore_events( p, lp );
+}
+
+void
+ckpt_restore_mpi( mpi_process * p,
+		  tw_lp * lp )
+{
+    const char * r = ckpt_lookup( lp );
+
+    r = ckpt_get( r, p, sizeof(mpi_process) );
+    r = ckpt_get( r, lp->rng, sizeof(tw_rng_stream) );
+    ckpt_restore_events( r, lp );
+}
+
 /* initialize MPI process LP */
 void
 mpi_init( mpi_process * p,
@@ -215,17 +724,111 @@ mpi_init( mpi_process * p,
     tw_stime ts;
     nodes_message *m;
     p->message_counter = 0;
+    p->available_time = 0.0;
+    p->trace_cursor = 0;
+    memset( &p->ckpt, 0, sizeof(torus_ckpt) );
+
+    /* a process LP of its own takes its own checkpoint, a combined one that of its node */
+    if( !combined_lp )
+     {
+       ckpt_current = &p->ckpt;
+       ckpt_cause = NULL;
+       if( restart_prefix[0] )
+	 {
+	   ckpt_restore_mpi( p, lp );
+	   ckpt_schedule( lp );
+	   return;
+	 }
+       ckpt_schedule( lp );
+     }
+
+    /* a trace replaying process starts at its first send, if it has any */
+    if( trace_file[0] )
+      {
+	int rank = ( combined_lp ? lp->gid : lp->gid - N_nodes );
+
+	if( torus_trace_count( rank ) > 0 )
+	  {
+	    e = torus_event_new( lp->gid, ROSS_MAX( torus_trace_record_at( rank, 0 )->time, 0.1 ), lp );
+	    m = tw_event_data( e );
+	    m->type = MPI_SEND;
+	    torus_event_send( e );
+	  }
+	return;
+      }
 
     /* Start a MPI send event on each MPI LP */
     ts =  tw_rand_exponential(lp->rng, MEAN_INTERVAL);
-    e = tw_event_new( lp->gid, ts, lp );
+    e = torus_event_new( lp->gid, ts, lp );
     m = tw_event_data( e );
     m->type = MPI_SEND;
 
-    p->available_time = 0.0;
-    tw_event_send( e );
+    torus_event_send( e );
 }
 
+/*Initialize the torus model, this initialization part is borrowed from Ning's torus model */
+void
+torus_init( nodes_state * s,
+	   tw_lp * lp )
+{
+    int i, j;
+
+  /* the LP's real and simulated torus co-ordinates come from the per-PE tables */
+  s->dim_position = torus_coords( lp->gid );
+  s->dim_position_sim = torus_coords_sim( lp->gid );
+  s->neighbour = &neighbour_table[ lp->id * 2 * N_dims ];
+  s->neighbour_sim = &neighbour_table_sim[ lp->id * 2 * N_dims_sim ];
+
+  if( lp->gid == TRACK_LP )
+  {
+    printf("\n LP %d assigned dimensions: ", (int)lp->gid);
+
+    for( i = 0; i < N_dims_sim; i++ )
+        printf(" %d ", s->dim_position_sim[ i ]);
+
+    printf("\t ");
+
+    for( i = 0; i < N_dims; i++ )
+        printf(" %d ", s->dim_position[ i ]);
+  }
+
+  /* calculate minus and plus neighbour's lpID */
+  for ( j = 0; j < N_dims; j++ )
+    for ( i = 0; i < 2; i++ )
+      s->neighbour[ i + ( j * 2 ) ] = torus_neighbour( lp->gid, s->dim_position, dim_length, factor, j, i );
+
+  /* calculate minus and plus neighbour's lpID of the simulated torus */
+  for ( j = 0; j < N_dims_sim; j++ )
+    for ( i = 0; i < 2; i++ )
+      s->neighbour_sim[ i + ( j * 2 ) ] = torus_neighbour( lp->gid, s->dim_position_sim, dim_length_sim, factor_sim, j, i );
+
+  for( j=0; j < 2 * N_dims; j++ )
+   {
+    for( i = 0; i < NUM_VC; i++ )
+     {
+       s->port[ j ].buffer[ i ] = 0;
+       s->port[ j ].next_link_available_time[ i ] = 0.0;
+       s->port[ j ].next_credit_available_time[ i ] = 0.0;
+     }
+    s->port[ j ].wait_head = NULL;
+    s->port[ j ].wait_tail = NULL;
+    s->port[ j ].wait_count = 0;
+   }
+  // record LP time
+    s->packet_counter = 0;
+
+  memset( &s->ckpt, 0, sizeof(torus_ckpt) );
+  ckpt_current = &s->ckpt;
+  ckpt_cause = NULL;
+
+  /* a combined LP also runs the MPI process of this node */
+  if( restart_prefix[0] )
+    ckpt_restore_node( s, lp );
+  else if( combined_lp )
+    mpi_init( &s->mpi, lp );
+
+  ckpt_schedule( lp );
+}
 /*Returns the next neighbor to which the packet should be routed by using DOR (Taken from Ning's code of the torus model)*/
 void
 dimension_order_routing( nodes_state * s,
@@ -233,45 +836,39 @@ dimension_order_routing( nodes_state * s,
 			     int * dim,
 			     int * dir )
 {
-  int dim_N[ N_dims ],
-      dest[ N_dims ],
-      i;
+  int i, diff;
 
-  dim_N[ 0 ] = *dst_lp;
-
-  // find destination dimensions using destination LP ID
-  for ( i = 0; i < N_dims; i++ )
-    {
-      dest[ i ] = dim_N[ i ] % dim_length[ i ];
-      dim_N[ i + 1 ] = ( dim_N[ i ] - dest[ i ] ) / dim_length[ i ];
-    }
+  // destination dimensions come from the per-PE coordinate table
+  const unsigned char * dest = torus_coords( *dst_lp );
 
   for( i = 0; i < N_dims; i++ )
     {
-      if ( s->dim_position[ i ] - dest[ i ] > half_length[ i ] )
+      diff = s->dim_position[ i ] - dest[ i ];
+
+      if ( diff > half_length[ i ] )
 	{
-	  *dst_lp = s->neighbour_plus_lpID[ i ];
+	  *dst_lp = s->neighbour[ 1 + ( i * 2 ) ];
 	  *dim = i;
 	  *dir = 1;
 	  break;
 	}
-      if ( s->dim_position[ i ] - dest[ i ] < -half_length[ i ] )
+      if ( diff < -half_length[ i ] )
 	{
-	  *dst_lp = s->neighbour_minus_lpID[ i ];
+	  *dst_lp = s->neighbour[ i * 2 ];
 	  *dim = i;
 	  *dir = 0;
 	  break;
 	}
-      if ( ( s->dim_position[ i ] - dest[ i ] <= half_length[ i ] ) && ( s->dim_position[ i ] - dest[ i ] > 0 ) )
+      if ( ( diff <= half_length[ i ] ) && ( diff > 0 ) )
 	{
-	  *dst_lp = s->neighbour_minus_lpID[ i ];
+	  *dst_lp = s->neighbour[ i * 2 ];
 	  *dim = i;
 	  *dir = 0;
 	  break;
 	}
-      if (( s->dim_position[ i ] - dest[ i ] >= -half_length[ i ] ) && ( s->dim_position[ i ] - dest[ i ] < 0) )
+      if (( diff >= -half_length[ i ] ) && ( diff < 0) )
 	{
-	  *dst_lp = s->neighbour_plus_lpID[ i ];
+	  *dst_lp = s->neighbour[ 1 + ( i * 2 ) ];
 	  *dim = i;
 	  *dir = 1;
 	  break;
@@ -299,9 +896,9 @@ packet_generate( nodes_state * s,
      {
 	int dest_counter = msg->dest_lp;
 	if( dest_counter < N_dims_sim)
-	   msg->dest_lp = s->neighbour_minus_lpID_sim[dest_counter];
+	   msg->dest_lp = s->neighbour_sim[dest_counter * 2];
 	  else if(dest_counter >= N_dims_sim && dest_counter < 2 * N_dims_sim)
-	     msg->dest_lp = s->neighbour_plus_lpID_sim[dest_counter-N_dims_sim];
+	     msg->dest_lp = s->neighbour_sim[1 + (dest_counter-N_dims_sim) * 2];
      }
 
    /* again for the diagonal traffic, we calculate destinations at the torus LP level not
@@ -309,7 +906,7 @@ packet_generate( nodes_state * s,
    if(TRAFFIC == DIAGONAL)
    {
         msg->dest_lp = 0;
-	int dest[N_dims_sim];
+	int dest[MAX_DIMS];
 	for( i = 0; i < N_dims_sim; i++ )
 	 {
 	   dest[i] = dim_length_sim[i] - s->dim_position_sim[i] -1;
@@ -333,11 +930,11 @@ packet_generate( nodes_state * s,
     	assert( 0 );
     }
 
-    for(j = 0; j < num_chunks; j++)
+    for(j = 0; j < sends_per_packet; j++)
     {
        /* adding a small constant to prevent zero time-stamps */
        ts = 0.1 + tw_rand_exponential(lp->rng, MEAN_INTERVAL/200);
-       e_h = tw_event_new( lp->gid, ts, lp);
+       e_h = torus_event_new( lp->gid, ts, lp);
 
        msg->source_direction = tmp_dir;
        msg->source_dim = tmp_dim;
@@ -347,20 +944,10 @@ packet_generate( nodes_state * s,
        m->dest_lp = msg->dest_lp;
        m->travel_start_time = msg->travel_start_time;
        m->packet_ID = msg->packet_ID;
-       m->chunk_id = j;
+       m->chunk_id = ( j + 1 ) * chunks_per_event - 1;
        m->sender_lp = -1;
 
-       int dim_N[ N_dims ];
-       dim_N[ 0 ] = m->dest_lp;
-
-      // find destination dimensions using destination LP ID
-       for (i=0; i < N_dims; i++)
-        {
-           m->dest[ i ] = dim_N[ i ] % dim_length[ i ];
-           dim_N[ i + 1 ] = ( dim_N[ i ] - m->dest[ i ] ) / dim_length[ i ];
-        }
-
-       if(s->buffer[ tmp_dir + ( tmp_dim * 2 ) ][ 0 ] < num_buf_slots * num_chunks)
+       if(s->port[ tmp_dir + ( tmp_dim * 2 ) ].buffer[ 0 ] + chunks_per_event <= num_buf_slots * num_chunks)
         {
 	 m->my_N_hop = 0;
 	 m->wait_type = -1;
@@ -376,11 +963,11 @@ packet_generate( nodes_state * s,
 		     time %lf tmp_dir %d tmp_dim %d
 		     num_chunks %d dest_lp %lld",
 		     lp->gid, m->packet_ID,
-		     s->buffer[ tmp_dir + ( tmp_dim * 2 ) ][ 0 ],
+		     s->port[ tmp_dir + ( tmp_dim * 2 ) ].buffer[ 0 ],
 		     tw_now(lp), tmp_dir, tmp_dim,
 		     num_chunks, msg->dest_lp );*/
 #endif
-       tw_event_send(e_h);
+       torus_event_send( e_h );
         }
       else
        {
@@ -388,7 +975,7 @@ packet_generate( nodes_state * s,
 		       (int)lp->gid,
 		       tmp_dir,
 		       tmp_dim,
-		       s->buffer[ tmp_dir + ( tmp_dim * 2 ) ][ 0 ],
+		       s->port[ tmp_dir + ( tmp_dim * 2 ) ].buffer[ 0 ],
 		       (int)msg->dest_lp,
 		       msg->wait_type);
        exit(-1);
@@ -413,19 +1000,20 @@ credit_send( nodes_state * s,
     int src_dir = msg->source_direction;
     int src_dim = msg->source_dim;
 
-    msg->saved_available_time = s->next_credit_available_time[(2 * src_dim) + src_dir][0];
-    s->next_credit_available_time[(2 * src_dim) + src_dir][0] = ROSS_MAX(s->next_credit_available_time[(2 * src_dim) + src_dir][0], tw_now(lp));
+    /* in wormhole mode the credit for the whole packet goes back once its tail has arrived */
+    msg->saved_available_time = s->port[(2 * src_dim) + src_dir].next_credit_available_time[0];
+    s->port[(2 * src_dim) + src_dir].next_credit_available_time[0] = ROSS_MAX(s->port[(2 * src_dim) + src_dir].next_credit_available_time[0], tw_now(lp) + serialization_delay);
     ts =  credit_delay + tw_rand_exponential(lp->rng, credit_delay/1000);
-    s->next_credit_available_time[(2 * src_dim) + src_dir][0] += ts;
+    s->port[(2 * src_dim) + src_dir].next_credit_available_time[0] += ts;
 
-    buf_e = tw_event_new( msg->sender_lp, s->next_credit_available_time[(2 * src_dim) + src_dir][0] - tw_now(lp), lp);
+    buf_e = torus_event_new( msg->sender_lp, s->port[(2 * src_dim) + src_dir].next_credit_available_time[0] - tw_now(lp), lp);
 
     m = tw_event_data(buf_e);
     m->source_direction = msg->source_direction;
     m->source_dim = msg->source_dim;
 
     m->type = CREDIT;
-    tw_event_send( buf_e );
+    torus_event_send( buf_e );
 }
 
 void
@@ -434,21 +1022,29 @@ update_waiting_list( nodes_state * s,
 		     nodes_message * msg,
 		     tw_lp * lp )
 {
-   int loc = s->wait_count;
-   if(loc >= WAITING_PACK_COUNT)
-	printf("\n Terminating application, memory tree size exceeded ");
+   int port = msg->wait_dir + ( msg->wait_dim * 2 );
+   waiting_packet * w;
 
-   assert(loc < WAITING_PACK_COUNT);
+   if(s->port[ port ].wait_count >= max_waiting)
+	tw_error(TW_LOC, "\n LP %d waiting queue dir %d dim %d exceeded %d packets ",
+		 (int)lp->gid, msg->wait_dir, msg->wait_dim, max_waiting);
 
 /*   printf("\n Inserting message wait type %d buffer %d dir %d dim %d", msg->wait_type,
-						  s->buffer[(msg->wait_dim * 2) + msg->wait_dir][0],
+						  s->port[ (msg->wait_dim * 2) + msg->wait_dir ].buffer[ 0 ],
 						  msg->wait_dir,
 						  msg->wait_dim);*/
-   s->waiting_list[loc].dim = msg->wait_dim;
-   s->waiting_list[loc].dir = msg->wait_dir;
-   s->waiting_list[loc].packet = msg;
-
-   s->wait_count = s->wait_count + 1;
+   w = waiting_packet_alloc();
+   memcpy(&w->packet, msg, sizeof(nodes_message));
+
+   /* append at the tail of the port FIFO */
+   w->prev = s->port[ port ].wait_tail;
+   if(s->port[ port ].wait_tail)
+      s->port[ port ].wait_tail->next = w;
+   else
+      s->port[ port ].wait_head = w;
+   s->port[ port ].wait_tail = w;
+
+   s->port[ port ].wait_count++;
 }
 
 /* send a packet from one torus node to another torus node.
@@ -491,11 +1087,11 @@ packet_send( nodes_state * s,
      }
 
     /* if buffer space is not available then add message in the waiting queue */
-    if(s->buffer[ tmp_dir + ( tmp_dim * 2 ) ][ 0 ] >= num_buf_slots * num_chunks)
+    if(s->port[ tmp_dir + ( tmp_dim * 2 ) ].buffer[ 0 ] + chunks_per_event > num_buf_slots * num_chunks)
     {
          // re-schedule the message in the future
 	 ts = 0.1 + tw_rand_exponential( lp->rng, MEAN_INTERVAL/200);
-	 e = tw_event_new( lp->gid, ts, lp );
+	 e = torus_event_new( lp->gid, ts, lp );
 	 m = tw_event_data( e );
          m->wait_type = SEND;
 	 m->type = WAIT;
@@ -513,11 +1109,10 @@ packet_send( nodes_state * s,
 
 	 m->packet_ID = msg->packet_ID;
 	 m->sender_lp = msg->sender_lp;
+	 m->travel_start_time = msg->travel_start_time;
+	 m->my_N_hop = msg->my_N_hop;
 
-	 for (i=0; i < N_dims; i++)
-           m->dest[i] = msg->dest[i];
-
-	 tw_event_send(e);
+	 torus_event_send( e );
    }
   else
   {
@@ -527,12 +1122,14 @@ packet_send( nodes_state * s,
        ts = tw_rand_exponential( lp->rng, ( double )head_delay/200 )+ head_delay;
 
 //    For reverse computation
-      msg->saved_available_time = s->next_link_available_time[tmp_dir + ( tmp_dim * 2 )][0];
+      msg->saved_available_time = s->port[ tmp_dir + ( tmp_dim * 2 ) ].next_link_available_time[0];
 
-      s->next_link_available_time[tmp_dir + ( tmp_dim * 2 )][0] = ROSS_MAX( s->next_link_available_time[ tmp_dir + ( tmp_dim * 2 )][0], tw_now(lp) );
-      s->next_link_available_time[tmp_dir + ( tmp_dim * 2 )][0] += ts;
+      /* the head arrives after the head latency, in wormhole mode the link stays busy
+       * until the rest of the packet has been serialized behind it */
+      s->port[ tmp_dir + ( tmp_dim * 2 ) ].next_link_available_time[0] = ROSS_MAX( s->port[ tmp_dir + ( tmp_dim * 2 ) ].next_link_available_time[0], tw_now(lp) );
+      s->port[ tmp_dir + ( tmp_dim * 2 ) ].next_link_available_time[0] += ts + serialization_delay;
 
-      e = tw_event_new( dst_lp, s->next_link_available_time[tmp_dir + ( tmp_dim * 2 )][0] - tw_now(lp), lp );
+      e = torus_event_new( dst_lp, s->port[ tmp_dir + ( tmp_dim * 2 ) ].next_link_available_time[0] - serialization_delay - tw_now(lp), lp );
 
       m = tw_event_data( e );
       m->type = ARRIVAL;
@@ -544,45 +1141,23 @@ packet_send( nodes_state * s,
       m->sender_lp = lp->gid;
       m->chunk_id = msg->chunk_id;
 
-      for( i = 0; i < N_dims; i++ )
-         m->dest[ i ] = msg->dest[ i ];
-
       m->dest_lp = msg->dest_lp;
 
       m->packet_ID = msg->packet_ID;
       m->travel_start_time = msg->travel_start_time;
 
       m->my_N_hop = msg->my_N_hop;
-      tw_event_send( e );
+      torus_event_send( e );
 
-      s->buffer[ tmp_dir + ( tmp_dim * 2 ) ][ 0 ]++;
+      s->port[ tmp_dir + ( tmp_dim * 2 ) ].buffer[ 0 ] += chunks_per_event;
 
       if(msg->chunk_id == num_chunks - 1 && msg->sender_lp == -1)
       {
         bf->c1 = 1;
-        int index = floor( N_COLLECT_POINTS * ( tw_now( lp ) / g_tw_ts_end ) );
-        N_generated_storage[ index ]++;
+        msg->stat_time = tw_now( lp );
      }
   } // end else
 }
-/*Once a credit arrives at the node, this method picks a waiting packet in the injection queue and schedules it */
-void
-waiting_packet_free(nodes_state * s, int loc)
-{
-  int i, max_count = s->wait_count - 1;
-
-  for(i = loc; i < max_count; i++) {
-	s->waiting_list[i].dim = s->waiting_list[i + 1].dim;
-	s->waiting_list[i].dir = s->waiting_list[i + 1].dir;
-	s->waiting_list[i].packet = s->waiting_list[i + 1].packet;
-    }
-  s->waiting_list[max_count].dim = -1;
-  s->waiting_list[max_count].dir = -1;
-  s->waiting_list[max_count].packet = NULL;
-
-  s->wait_count = s->wait_count - 1;
-}
-
 /*Processes the packet after it arrives from the neighboring torus node */
 void packet_arrive( nodes_state * s,
 		    tw_bf * bf,
@@ -608,30 +1183,40 @@ void packet_arrive( nodes_state * s,
         if( msg->chunk_id == num_chunks - 1 )
         {
 		bf->c2 = 1;
-		int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
+		msg->stat_time = tw_now( lp );
+		msg->stat_queue_depth = 0;
     		for(i = 0; i < 2 * N_dims; i++)
-	          N_queue_depth[index]+=s->buffer[i][0];
+	          msg->stat_queue_depth += s->port[ i ].buffer[ 0 ];
 
-	        e = tw_event_new(lp->gid + N_nodes, ts, lp);
+	        /* the packet is complete once its tail has arrived, a combined LP
+		   receives it right away instead of sending an MPI_RECV event */
+		if( combined_lp )
+		{
+		   /* the queue depth is then sampled at the receive time as well */
+		   if( tw_now( lp ) + ts + serialization_delay < g_tw_ts_end )
+		   {
+		      bf->c4 = 1;
+		      msg->stat_time = tw_now( lp ) + ts + serialization_delay;
+		   }
+		   return;
+		}
+	        e = torus_event_new(lp->gid + N_nodes, ts + serialization_delay, lp);
 		m = tw_event_data(e);
 	        m->type = MPI_RECV;
 	        m->travel_start_time = msg->travel_start_time;
 		m->my_N_hop = msg->my_N_hop;
 		m->packet_ID = msg->packet_ID;
-		tw_event_send(e);
+		torus_event_send( e );
         }
     }
   else
     {
       /* forward the flit to another node */
-      e = tw_event_new(lp->gid, ts , lp);
+      e = torus_event_new(lp->gid, ts , lp);
       m = tw_event_data( e );
       m->type = SEND;
 
       // Carry on the message info
-      for( i = 0; i < N_dims; i++ )
-	m->dest[i] = msg->dest[i];
-
       m->dest_lp = msg->dest_lp;
 
       m->source_dim = msg->source_dim;
@@ -645,7 +1230,7 @@ void packet_arrive( nodes_state * s,
       m->chunk_id = msg->chunk_id;
 
       m->next_stop = -1;
-      tw_event_send(e);
+      torus_event_send( e );
    }
 }
 
@@ -664,6 +1249,8 @@ void mpi_msg_send(mpi_process * p,
     nodes_message *m;
     tw_lpid final_dst;
     int i;
+    /* the MPI process lpID, also when the process runs inside its node LP */
+    tw_lpid mpi_gid = combined_lp ? lp->gid + N_nodes : lp->gid;
     bf->c3 = 0;
     bf->c4 = 0;
 
@@ -687,9 +1274,9 @@ void mpi_msg_send(mpi_process * p,
 		       that the next randomly generated destination is also the same.
 			Therefore if randomly generated destination is the same as source, we use the following
 			calculation to make sure that the source and destinations are different */
-		    if( final_dst == lp->gid )
+		    if( final_dst == mpi_gid )
 		      {
-                        final_dst = N_nodes + (lp->gid + N_nodes/2) % N_nodes;
+                        final_dst = N_nodes + (mpi_gid + N_nodes/2) % N_nodes;
 		      }
 		}
 	  break;
@@ -714,19 +1301,21 @@ void mpi_msg_send(mpi_process * p,
      }
       tw_stime base_time = MEAN_PROCESS;
 
+      msg->saved_available_time = p->available_time;
+      /* every packet is injected by a GENERATE event at its own time, also in combined mode
+	 where that event goes from the node LP to itself */
       for( i=0; i < num_packets; i++ )
        {
 	      // Send the packet out
 	     ts = 0.1 + tw_rand_exponential(lp->rng, MEAN_INTERVAL/200);
-             msg->saved_available_time = p->available_time;
 	     p->available_time = ROSS_MAX( p->available_time, tw_now(lp) );
 	     p->available_time += ts;
 
-	     e = tw_event_new( getProcID(lp->gid), p->available_time - tw_now(lp), lp );
+	     e = torus_event_new( getProcID(mpi_gid), p->available_time - tw_now(lp), lp );
 
 	     m = tw_event_data( e );
 	     m->type = GENERATE;
-             m->packet_ID = packet_offset * ( lp->gid * num_mpi_msgs * num_packets ) + p->message_counter;
+             m->packet_ID = packet_offset * ( mpi_gid * num_mpi_msgs * num_packets ) + p->message_counter;
 
              p->message_counter++;
 	     m->travel_start_time = tw_now( lp ) + ts;
@@ -739,38 +1328,100 @@ void mpi_msg_send(mpi_process * p,
 	 	}
 
  	     m->next_stop = -1;
-             tw_event_send( e );
+             torus_event_send( e );
      }
      ts = 0.1 + tw_rand_exponential( lp->rng, MEAN_INTERVAL);
-     e = tw_event_new( lp->gid, ts, lp );
+     e = torus_event_new( lp->gid, ts, lp );
      m = tw_event_data( e );
      m->type = MPI_SEND;
-     tw_event_send( e );
+     torus_event_send( e );
+}
+/* number of torus packets of a trace send, a send to the own rank stays off the network */
+int trace_packets( const torus_trace_record * rec,
+		   int rank )
+{
+    if( rec->dest == (unsigned int) rank )
+       return 0;
+    return ROSS_MAX( ( rec->bytes + PACKET_SIZE - 1 ) / PACKET_SIZE, 1 );
+}
+
+/*Replays the next send of the trace of this MPI process: the message is broken down to torus
+ packets for the node LP of the destination rank and the following send is scheduled at its
+ trace time */
+void mpi_trace_send(mpi_process * p,
+		    tw_bf * bf,
+		    nodes_message * msg,
+		    tw_lp * lp)
+{
+    tw_stime ts;
+    tw_event *e;
+    nodes_message *m;
+    int i, n_packets;
+    tw_lpid mpi_gid = combined_lp ? lp->gid + N_nodes : lp->gid;
+    int rank = mpi_gid - N_nodes;
+    const torus_trace_record * rec = torus_trace_record_at( rank, p->trace_cursor );
+
+    n_packets = trace_packets( rec, rank );
+    msg->trace_record = p->trace_cursor;
+    msg->saved_available_time = p->available_time;
+
+    for( i=0; i < n_packets; i++ )
+     {
+	ts = 0.1 + tw_rand_exponential(lp->rng, MEAN_INTERVAL/200);
+	p->available_time = ROSS_MAX( p->available_time, tw_now(lp) );
+	p->available_time += ts;
+
+	e = torus_event_new( getProcID(mpi_gid), p->available_time - tw_now(lp), lp );
+	m = tw_event_data( e );
+	m->type = GENERATE;
+	m->packet_ID = packet_offset * ( mpi_gid * num_mpi_msgs * num_packets ) + p->message_counter;
+	p->message_counter++;
+	m->travel_start_time = tw_now( lp ) + ts;
+	m->dest_lp = rec->dest;
+	m->next_stop = -1;
+	torus_event_send( e );
+     }
+
+    p->trace_cursor++;
+    if( p->trace_cursor < torus_trace_count( rank ) )
+     {
+	/* sends at the same time stamp go out 0.1 ns apart */
+	ts = torus_trace_record_at( rank, p->trace_cursor )->time - tw_now( lp );
+	e = torus_event_new( lp->gid, ROSS_MAX( ts, 0.1 ), lp );
+	m = tw_event_data( e );
+	m->type = MPI_SEND;
+	torus_event_send( e );
+     }
+}
+
+/* reverse of mpi_trace_send, the trace is read-only so the cursor is all there is to undo */
+void mpi_trace_send_rc(mpi_process * p,
+		       tw_bf * bf,
+		       nodes_message * msg,
+		       tw_lp * lp)
+{
+    int i, n_packets;
+    int rank = ( combined_lp ? lp->gid : lp->gid - N_nodes );
+    const torus_trace_record * rec;
+
+    p->trace_cursor--;
+    rec = torus_trace_record_at( rank, p->trace_cursor );
+    n_packets = trace_packets( rec, rank );
+
+    for( i=0; i < n_packets; i++ )
+       tw_rand_reverse_unif(lp->rng);
+
+    p->message_counter -= n_packets;
+    p->available_time = msg->saved_available_time;
 }
-/*Computes final latencies after a message is received */
+
+/*Keeps the receive time of a message, its latency is recorded once the event commits */
 void mpi_msg_recv(mpi_process * p,
 		  tw_bf * bf,
 		  nodes_message * msg,
 		  tw_lp * lp)
 {
- // Message arrives at final destination
-   bf->c3 = 0;
-   N_finished_msgs++;
-
-// For torus-dragonfly comparison only place the end time here
-    N_finished_packets++;
-    int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
-    N_finished_storage[index]++;
-    N_num_hops[index]+=msg->my_N_hop;
-    int i,j;
-    total_time += tw_now( lp ) - msg->travel_start_time;
-    total_hops += msg->my_N_hop;
-
-    if (max_latency < tw_now( lp ) - msg->travel_start_time) {
-	  bf->c3 = 1;
-	  msg->saved_available_time = max_latency;
-          max_latency=tw_now( lp ) - msg->travel_start_time;
-     }
+   msg->stat_time = tw_now( lp );
 }
 void mpi_event_handler( mpi_process * p,
 		       tw_bf * bf,
@@ -778,10 +1429,20 @@ void mpi_event_handler( mpi_process * p,
 		       tw_lp * lp )
 {
   *(int *) bf = (int) 0;
+  if( !combined_lp && ckpt_begin( &p->ckpt, msg, lp ) )
+     ckpt_take_mpi( p, lp );
+
   switch(msg->type)
   {
+     /* only makes sure the checkpoint is taken */
+     case CHECKPOINT:
+     break;
+
      case MPI_SEND:
-   	      mpi_msg_send(p, bf, msg, lp);
+	      if( trace_file[0] )
+		 mpi_trace_send(p, bf, msg, lp);
+	      else
+		 mpi_msg_send(p, bf, msg, lp);
      break;
 
      case MPI_RECV:
@@ -800,10 +1461,19 @@ void mpi_event_rc_handler( mpi_process * p,
                            nodes_message * msg,
                            tw_lp * lp)
 {
+ if( !combined_lp )
+    ckpt_begin_rc( &p->ckpt, msg );
+
  switch(msg->type)
   {
      case MPI_SEND:
                 {
+		  if( trace_file[0] )
+		   {
+		     mpi_trace_send_rc(p, bf, msg, lp);
+		     return;
+		   }
+
 		  if(bf->c4)
 		    return;
 
@@ -822,35 +1492,56 @@ void mpi_event_rc_handler( mpi_process * p,
 	     }
      break;
 
-     case MPI_RECV:
-		  {
-			int index = floor( N_COLLECT_POINTS * ( tw_now( lp ) / g_tw_ts_end ) );
-			N_finished_msgs--;
-			N_finished_packets--;
-			N_finished_storage[index]--;
-			N_num_hops[index] -= msg->my_N_hop;
-
-			total_time -= tw_now( lp ) - msg->travel_start_time;
-			total_hops-=msg->my_N_hop;
-
-			if(bf->c3)
-			  max_latency= msg->saved_available_time;
-		  }
-      break;
   }
 }
 
+/* commit handler for a MPI process LP, records the latency of a received message */
+void mpi_commit_handler( mpi_process * p,
+			 tw_bf * bf,
+			 nodes_message * msg,
+			 tw_lp * lp)
+{
+  if( !combined_lp )
+     ckpt_commit( &p->ckpt, msg, lp );
+
+  if(msg->type == MPI_RECV)
+     torus_stats_finished( msg->stat_time, msg->stat_time - msg->travel_start_time, msg->my_N_hop );
+
+  /* a committed trace send is never read again */
+  if(msg->type == MPI_SEND && trace_file[0])
+     torus_trace_release( combined_lp ? lp->gid : lp->gid - N_nodes, msg->trace_record );
+}
+
 void
 final( nodes_state * s, tw_lp * lp )
 {
+  /* a run that ends at the checkpoint time has not taken it yet */
+  if( ckpt_file )
+   {
+     if( !s->ckpt.taken )
+	ckpt_take_node( s, lp );
+     ckpt_write( &s->ckpt, lp );
+   }
+}
 
+void
+mpi_final( mpi_process * p, tw_lp * lp )
+{
+  if( ckpt_file && !combined_lp )
+   {
+     if( !p->ckpt.taken )
+	ckpt_take_mpi( p, lp );
+     ckpt_write( &p->ckpt, lp );
+   }
 }
 
 tw_lp * torus_mapping_to_lp( tw_lpid lpid )
 {
     int index;
 
-    if(lpid < N_nodes)
+    if(block_mapping)
+       index = lpid < N_nodes ? block_offset( lpid ) : nlp_nodes_per_pe + block_offset( getProcID( lpid ) );
+    else if(lpid < N_nodes)
        index = lpid - g_tw_mynode * nlp_nodes_per_pe - getRem();
     else
        index = nlp_nodes_per_pe + (lpid - g_tw_mynode * nlp_mpi_procs_per_pe - N_nodes - getRem());
@@ -858,68 +1549,70 @@ tw_lp * torus_mapping_to_lp( tw_lpid lpid )
     return g_tw_lp[index];
 }
 
+/*Once a credit arrives at the node, this method picks the oldest packet waiting on that port and schedules it */
 void packet_buffer_process( nodes_state * s, tw_bf * bf, nodes_message * msg, tw_lp * lp )
 {
-   msg->wait_loc = -1;
-   s->buffer[ msg->source_direction + ( msg->source_dim * 2 ) ][  0 ]-=1;
+  int port = msg->source_direction + ( msg->source_dim * 2 );
+  msg->wait_rec = NULL;
+  s->port[ port ].buffer[ 0 ] -= chunks_per_event;
 
   tw_event * e_h;
   nodes_message * m;
   tw_stime ts;
+  waiting_packet * w = s->port[ port ].wait_head;
   bf->c3 = 0;
-  int loc=s->wait_count, j=0;
-  for(j = 0; j < loc; j++)
+
+  if( w )
    {
-    if( s->waiting_list[j].dim == msg->source_dim && s->waiting_list[j].dir == msg->source_direction)
-     {
-        bf->c3=1;
-	ts = tw_rand_exponential(lp->rng, MEAN_INTERVAL/100);
-        e_h = tw_event_new( lp->gid, ts, lp );
-        m = tw_event_data( e_h );
-     	memcpy(m, s->waiting_list[j].packet, sizeof(nodes_message));
-
-//        For reverse computation, also copy data to the msg
-   	memcpy(msg, s->waiting_list[j].packet, sizeof(nodes_message));
-	msg->wait_loc = j;
-	msg->type = CREDIT;
-	m->type = SEND;
-        tw_event_send(e_h);
-        waiting_packet_free(s, j);
-        break;
-    }
+     bf->c3=1;
+
+     /* unlink the head, the record is handed back to the slab on commit */
+     s->port[ port ].wait_head = w->next;
+     if( w->next )
+        w->next->prev = NULL;
+     else
+        s->port[ port ].wait_tail = NULL;
+     s->port[ port ].wait_count--;
+     msg->wait_rec = w;
+
+     ts = tw_rand_exponential(lp->rng, MEAN_INTERVAL/100);
+     e_h = torus_event_new( lp->gid, ts, lp );
+     m = tw_event_data( e_h );
+     memcpy(m, &w->packet, sizeof(nodes_message));
+     m->type = SEND;
+     m->wait_rec = NULL;
+     torus_event_send( e_h );
   }
 }
 
 /* reverse handler code for a node */
 void node_rc_handler(nodes_state * s, tw_bf * bf, nodes_message * msg, tw_lp * lp)
 {
+  ckpt_begin_rc( &s->ckpt, msg );
+  if( msg->ckpt_taken )
+     s->mpi.ckpt.taken = 0;
+  if( msg->type == CHECKPOINT )
+     return;
+
   switch(msg->type)
     {
        case GENERATE:
 		   {
 		     int i;
-		     for(i=0; i < num_chunks; i++)
+		     for(i=0; i < sends_per_packet; i++)
   		        tw_rand_reverse_unif(lp->rng);
 		   }
 	break;
 
 	case ARRIVAL:
 		   {
-		     if(bf->c2)
-		     {
-			int i;
-		        int index = floor(N_COLLECT_POINTS*(tw_now(lp)/g_tw_ts_end));
-	  	        for(i = 0; i < 2 * N_dims; i++)
-              	            N_queue_depth[index]-=s->buffer[i][0];
-		    }
-
  		    msg->my_N_hop--;
   		    tw_rand_reverse_unif(lp->rng);
 		    tw_rand_reverse_unif(lp->rng);
 		    int next_dim = msg->source_dim;
 		    int next_dir = msg->source_direction;
 
-		    s->next_credit_available_time[next_dir + ( next_dim * 2 )][0] = msg->saved_available_time;
+		    s->port[next_dir + ( next_dim * 2 )].next_credit_available_time[0] = msg->saved_available_time;
 		   }
 	break;
 
@@ -931,59 +1624,102 @@ void node_rc_handler(nodes_state * s, tw_bf * bf, nodes_message * msg, tw_lp * l
                         int next_dim = msg->saved_src_dim;
 			int next_dir = msg->saved_src_dir;
 
-			s->next_link_available_time[next_dir + ( next_dim * 2 )][0] = msg->saved_available_time;
-
-			s->buffer[ next_dir + ( next_dim * 2 ) ][ 0 ] --;
+			s->port[ next_dir + ( next_dim * 2 ) ].next_link_available_time[0] = msg->saved_available_time;
 
-                        if(bf->c1)
-			  {
-			    int index = floor( N_COLLECT_POINTS * ( tw_now( lp ) / g_tw_ts_end ) );
-			    N_generated_storage[ index ]--;
-			  }
+			s->port[ next_dir + ( next_dim * 2 ) ].buffer[ 0 ] -= chunks_per_event;
 		    }
 		 }
 	break;
 
         case WAIT:
 		{
-		     s->wait_count-=1;
-		     int loc = s->wait_count;
-		     s->waiting_list[loc].dim = -1;
-		     s->waiting_list[loc].dir = -1;
-		     s->waiting_list[loc].packet = NULL;
+		     /* the packet queued by this event is still the tail of its port FIFO */
+		     int port = msg->wait_dir + ( msg->wait_dim * 2 );
+		     waiting_packet * w = s->port[ port ].wait_tail;
+
+		     s->port[ port ].wait_tail = w->prev;
+		     if( w->prev )
+			w->prev->next = NULL;
+		     else
+			s->port[ port ].wait_head = NULL;
+		     s->port[ port ].wait_count--;
+		     waiting_packet_release( w );
 		}
         break;
 
        case CREDIT:
 		{
-		  s->buffer[ msg->source_direction + ( msg->source_dim * 2 ) ][  0 ]++;
+		  int port = msg->source_direction + ( msg->source_dim * 2 );
+		  s->port[ port ].buffer[ 0 ] += chunks_per_event;
 		  if(bf->c3)
 		  {
+		     /* put the released packet back at the head of its port FIFO */
+		     waiting_packet * w = msg->wait_rec;
+
 		     tw_rand_reverse_unif(lp->rng);
-		     int loc = msg->wait_loc, i;
-                     int max_count = s->wait_count;
-		     if(s->wait_count >= WAITING_PACK_COUNT)
-			printf("\n Exceeded maximum count!!! ");
-		     for(i = max_count; i > loc ; i--)
-                      {
-		  	  s->waiting_list[i].dim = s->waiting_list[i-1].dim;
-			  s->waiting_list[i].dir = s->waiting_list[i-1].dir;
-			  s->waiting_list[i].packet = s->waiting_list[i-1].packet;
-                      }
-		     s->waiting_list[loc].dim = msg->source_dim;
-		     s->waiting_list[loc].dir = msg->source_direction;
-		     s->waiting_list[loc].packet = msg;
-		     s->wait_count = s->wait_count + 1;
+		     w->prev = NULL;
+		     w->next = s->port[ port ].wait_head;
+		     if( w->next )
+			w->next->prev = w;
+		     else
+			s->port[ port ].wait_tail = w;
+		     s->port[ port ].wait_head = w;
+		     s->port[ port ].wait_count++;
+		     msg->wait_rec = NULL;
 		 }
               }
        break;
+
+       case MPI_SEND:
+		mpi_event_rc_handler( &s->mpi, bf, msg, lp );
+       break;
      }
 }
 
+/* commit handler for a node, a waiting packet released by a credit can no longer be rolled back
+ * and generated and delivered packets are recorded in the statistics */
+void
+node_commit_handler(nodes_state * s, tw_bf * bf, nodes_message * msg, tw_lp * lp)
+{
+  ckpt_commit( &s->ckpt, msg, lp );
+
+  switch(msg->type)
+   {
+     case CREDIT:
+	if(bf->c3 && msg->wait_rec)
+	 {
+	   waiting_packet_release( msg->wait_rec );
+	   msg->wait_rec = NULL;
+	 }
+     break;
+
+     case MPI_SEND:
+	mpi_commit_handler( &s->mpi, bf, msg, lp );
+     break;
+
+     case SEND:
+	if(bf->c3 && bf->c1)
+	   torus_stats_generated( msg->stat_time );
+     break;
+
+     case ARRIVAL:
+	if(bf->c2)
+	 {
+	   torus_stats_queue_depth( msg->stat_time, msg->stat_queue_depth );
+	   if(bf->c4)
+	      torus_stats_finished( msg->stat_time, msg->stat_time - msg->travel_start_time, msg->my_N_hop );
+	 }
+     break;
+   }
+}
+
 void
 event_handler(nodes_state * s, tw_bf * bf, nodes_message * msg, tw_lp * lp)
 {
  *(int *) bf = (int) 0;
+ if( ckpt_begin( &s->ckpt, msg, lp ) )
+    ckpt_take_node( s, lp );
+
  switch(msg->type)
  {
   case GENERATE:
@@ -1001,6 +1737,12 @@ event_handler(nodes_state * s, tw_bf * bf, nodes_message * msg, tw_lp * lp)
   case WAIT:
     update_waiting_list(s, bf, msg, lp);
    break;
+  case MPI_SEND:
+    mpi_event_handler(&s->mpi, bf, msg, lp);
+   break;
+  /* only makes sure the checkpoint is taken */
+  case CHECKPOINT:
+   break;
   DEFAULT:
 	printf("\n Being sent to wrong LP");
   break;
@@ -1013,7 +1755,7 @@ tw_lptype nodes_lps[] =
         (pre_run_f) NULL,
 		(event_f) event_handler,
 		(revent_f) node_rc_handler,
-    (commit_f) NULL,
+		(commit_f) node_commit_handler,
 		(final_f) final,
 		(map_f) mapping,
 		sizeof(nodes_state),
@@ -1023,14 +1765,56 @@ tw_lptype nodes_lps[] =
            (pre_run_f) NULL,
 	       (event_f) mpi_event_handler,
 	       (revent_f) mpi_event_rc_handler,
-         (commit_f) NULL,
-	       (final_f) final,
+         (commit_f) mpi_commit_handler,
+	       (final_f) mpi_final,
 	       (map_f) mapping,
 	       sizeof(mpi_process),
 	},
 	{0},
 };
 
+/* Places the block of nodes owned by this rank, each MPI process LP goes on the KP of its node LP */
+void block_torus_mapping(void)
+{
+  int i, j, offset;
+  tw_lpid gid;
+  tw_kpid kpid;
+  tw_pe * pe;
+  int origin[MAX_DIMS];
+  tw_peid rank = g_tw_mynode;
+
+  for(j = 0; j < N_dims; j++)
+   {
+     origin[j] = (rank % block_count[j]) * block_length[j];
+     rank /= block_count[j];
+   }
+
+  for(i = 0; i < nlp_nodes_per_pe; i++)
+   {
+     gid = 0;
+     offset = i;
+     for(j = 0; j < N_dims; j++)
+      {
+	gid += (origin[j] + offset % block_length[j]) * factor[j];
+	offset /= block_length[j];
+      }
+
+     kpid = block_kp(gid);
+     pe = tw_getpe(kpid % g_tw_npe);
+
+     tw_lp_onpe(i, pe, gid);
+     tw_lp_onkp(g_tw_lp[i], g_tw_kp[kpid]);
+     tw_lp_settype(i, &nodes_lps[0]);
+
+     if(combined_lp)
+       continue;
+
+     tw_lp_onpe(nlp_nodes_per_pe + i, pe, N_nodes + gid);
+     tw_lp_onkp(g_tw_lp[nlp_nodes_per_pe + i], g_tw_kp[kpid]);
+     tw_lp_settype(nlp_nodes_per_pe + i, &nodes_lps[1]);
+   }
+}
+
 void torus_mapping(void)
 {
   tw_lpid kpid;
@@ -1041,6 +1825,11 @@ void torus_mapping(void)
    tw_kp_onpe(kpid, g_tw_pe[0]);
 
   int i;
+  if(block_mapping)
+   {
+     block_torus_mapping();
+     return;
+   }
   for(i = 0; i < nlp_nodes_per_pe; i++)
    {
      kpid = i % g_tw_nkp;
@@ -1062,13 +1851,26 @@ const tw_optdef app_opt [] =
 {
 	TWOPT_GROUP("Nodes Model"),
 	TWOPT_UINT("memory", opt_mem, "optimistic memory"),
+	TWOPT_CHAR("dims", dims_str, "comma separated torus dimension lengths"),
+	TWOPT_CHAR("dims_sim", dims_sim_str, "dimension lengths of the simulated torus used by the traffic patterns (default: dims)"),
 	TWOPT_UINT("vc_size", vc_size, "VC size"),
+	TWOPT_UINT("max_waiting", max_waiting, "maximum number of packets waiting on a port"),
 	TWOPT_ULONG("mpi-message-size", mpi_message_size, "mpi-message-size"),
 	TWOPT_UINT("mem_factor", mem_factor, "mem_factor"),
 	TWOPT_CHAR("traffic", traffic_str, "uniform, nearest, diagonal"),
+	TWOPT_CHAR("mapping", mapping_str, "linear (contiguous lpID ranges) or block (near-cubic torus blocks per PE and KP)"),
 	TWOPT_STIME("injection_interval", injection_interval, "messages are injected during this interval only "),
 	TWOPT_STIME("link_bandwidth", link_bandwidth, " link bandwidth per channel "),
 	TWOPT_STIME("arrive_rate", MEAN_INTERVAL, "packet arrive rate"),
+	TWOPT_UINT("wormhole", wormhole, "1 to move whole packets per event instead of 32-byte chunks"),
+	TWOPT_UINT("combined", combined_lp, "1 to run each MPI process inside its torus node LP"),
+	TWOPT_CHAR("stats_file", stats_file, "file for the time series of throughput, queue depth and latency"),
+	TWOPT_UINT("stats_binary", stats_binary, "1 to write the time series as binary doubles instead of CSV"),
+	TWOPT_STIME("latency_bin", latency_bin, "width of the latency histogram bins in ns"),
+	TWOPT_CHAR("trace", trace_file, "binary MPI trace replayed instead of the synthetic traffic"),
+	TWOPT_CHAR("checkpoint", checkpoint_prefix, "write the model state at checkpoint_time to <checkpoint>.<rank>"),
+	TWOPT_STIME("checkpoint_time", checkpoint_time, "simulation time of the checkpoint"),
+	TWOPT_CHAR("restart", restart_prefix, "continue from the checkpoint in <restart>.<rank>"),
 	TWOPT_END()
 };
 
@@ -1090,6 +1892,15 @@ main(int argc, char **argv, char **env)
         else
 	   printf("\n Incorrect traffic pattern specified, using %s as default ", traffic_str );
 
+	N_dims = parse_dims(dims_str, dim_length);
+	if(dims_sim_str[0])
+	    N_dims_sim = parse_dims(dims_sim_str, dim_length_sim);
+	else
+	  {
+	    N_dims_sim = N_dims;
+	    memcpy(dim_length_sim, dim_length, sizeof(dim_length));
+	  }
+
 	/* for automatically reducing the channel link bandwidth of a 7-D or a 9-D torus */
 	link_bandwidth = (link_bandwidth * 10) / (2 * N_dims);
 
@@ -1100,6 +1911,28 @@ main(int argc, char **argv, char **env)
 	  N_nodes*=dim_length[i];
 	  N_mpi_procs*=dim_length[i];
 	}
+
+	if(strcmp(mapping_str, "block") == 0)
+	  {
+	    block_mapping = 1;
+	    if(!torus_block_split(dim_length, block_count, tw_nnodes()))
+	       tw_error(TW_LOC, "\n Block mapping cannot split torus %s over %d ranks ", dims_str, (int)tw_nnodes());
+
+	    for (i=0; i<N_dims; i++)
+	       block_length[i] = dim_length[i] / block_count[i];
+
+	    /* cut the block of every rank again into one sub-block per KP if possible */
+	    kp_blocks = torus_block_split(block_length, kp_count, g_tw_nkp);
+	  }
+	else if(strcmp(mapping_str, "linear") != 0)
+	    printf("\n Incorrect mapping specified, using linear mapping ");
+
+	int N_nodes_sim = 1;
+	for (i=0; i<N_dims_sim; i++)
+	  N_nodes_sim*=dim_length_sim[i];
+
+	if(N_nodes_sim != N_nodes)
+	  tw_error(TW_LOC, "\n Simulated torus %s has %d nodes, torus %s has %d ", dims_sim_str, N_nodes_sim, dims_str, N_nodes);
 	nlp_nodes_per_pe = N_nodes/tw_nnodes()/g_tw_npe;
 	nlp_mpi_procs_per_pe = N_mpi_procs/tw_nnodes()/g_tw_npe;
 
@@ -1114,9 +1947,17 @@ main(int argc, char **argv, char **env)
 		nlp_nodes_per_pe++;
 		nlp_mpi_procs_per_pe++;
 	   }
+	/* a combined node LP runs its MPI process, there are no separate MPI process LPs */
+	if(combined_lp)
+	   nlp_mpi_procs_per_pe = 0;
+
         num_packets=1;
         num_chunks = PACKET_SIZE/chunk_size;
 
+	/* in wormhole mode one SEND/ARRIVAL event carries every chunk of the packet */
+	chunks_per_event = wormhole ? num_chunks : 1;
+	sends_per_packet = num_chunks / chunks_per_event;
+
         if( mpi_message_size > PACKET_SIZE)
          {
           num_packets = mpi_message_size / PACKET_SIZE;
@@ -1125,6 +1966,31 @@ main(int argc, char **argv, char **env)
 	    num_packets++;
          }
 
+	torus_setup();
+
+	if(trace_file[0])
+	  {
+	    int n_ranks = torus_trace_open(trace_file, N_nodes);
+	    if(n_ranks > N_nodes)
+	       tw_error(TW_LOC, "\n Trace %s has %d ranks, the torus only %d nodes ", trace_file, n_ranks, N_nodes);
+
+	    /* the trace gives the destination of every send */
+	    TRAFFIC = UNIFORM_RANDOM;
+	  }
+
+	if(block_mapping && tw_ismaster())
+	{
+		printf("\nBlock mapping: rank blocks of");
+		for (i=0; i<N_dims; i++)
+		   printf(" %d", block_length[i]);
+		printf(" nodes, %s KP sub-blocks \n", kp_blocks ? "near-cubic" : "contiguous");
+		printf("Fraction of remote hop events: block mapping %lf linear mapping %lf \n",
+		       remote_link_fraction(1), remote_link_fraction(0));
+	}
+
+	/* node LPs carry one torus_port per dimension and direction */
+	nodes_lps[0].state_sz = sizeof(nodes_state) + 2 * N_dims * sizeof(torus_port);
+
 	g_tw_mapping=CUSTOM;
      	g_tw_custom_initial_mapping=&torus_mapping;
         g_tw_custom_lp_global_to_local_map=&torus_mapping_to_lp;
@@ -1136,6 +2002,17 @@ main(int argc, char **argv, char **env)
 
         // BG/L torus network paper: Tokens are 32 byte chunks that is why the credit delay is adjusted according to bandwidth * 32
 	credit_delay = (1 / link_bandwidth) * 8;
+
+	/* Only ARRIVAL and CREDIT events travel between neighbouring nodes and so between PEs, an
+	   MPI process always shares the PE of its node. A packet arrives at least head_delay and a
+	   credit at least credit_delay after it is sent, the random parts of both delays only add
+	   to that. This bound is the lookahead for conservative runs (--synch=2), with a small
+	   margin for the rounding of the link and credit availability times. The shorter events
+	   an LP sends to itself or to the MPI process on its PE are not bound by it. */
+	g_tw_lookahead = ROSS_MIN(head_delay, credit_delay) * 0.999;
+
+	/* time for the chunks behind the head to cross a link */
+	serialization_delay = (chunks_per_event - 1) * head_delay;
 	packet_offset = (g_tw_ts_end/MEAN_INTERVAL) * num_packets;
 
 	if(tw_ismaster())
@@ -1143,62 +2020,76 @@ main(int argc, char **argv, char **env)
 		printf("\nTorus Network Model Statistics:\n");
 		printf("Number of nodes: %d Torus dimensions: %d ", N_nodes, N_dims);
 		printf(" Link Bandwidth: %f Traffic pattern: %s \n", link_bandwidth, traffic_str );
+		printf("Granularity: %s \n", wormhole ? "packet (wormhole)" : "chunk");
+		printf("MPI processes: %s \n", combined_lp ? "combined with node LPs" : "separate LPs");
+		printf("Lookahead: %lf \n", g_tw_lookahead);
 	}
 
-	tw_run();
-	unsigned long long total_finished_storage[N_COLLECT_POINTS];
-	unsigned long long total_generated_storage[N_COLLECT_POINTS];
-	unsigned long long total_num_hops[N_COLLECT_POINTS];
-	unsigned long long total_queue_depth[N_COLLECT_POINTS];
-	unsigned long long wait_length,event_length,N_total_packets_finish, N_total_msgs_finish, N_total_hop;
-	tw_stime total_time_sum,g_max_latency;
-
-	for( i=0; i<N_COLLECT_POINTS; i++ )
+	torus_stats_init(N_COLLECT_POINTS, g_tw_ts_end, latency_bin);
+
+	if(restart_prefix[0])
 	  {
-	    MPI_Reduce( &N_finished_storage[i], &total_finished_storage[i],1,
-                        MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-	    MPI_Reduce( &N_generated_storage[i], &total_generated_storage[i],1,
-                        MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-	    MPI_Reduce( &N_num_hops[i], &total_num_hops[i],1,
-			MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-	    MPI_Reduce( &N_queue_depth[i], &total_queue_depth[i],1,
-		         MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	    ckpt_open_restart();
+	    if(tw_ismaster())
+		printf("Restarting from %s at time %lf \n", restart_prefix, restart_time);
 	  }
 
-	MPI_Reduce( &total_time, &total_time_sum,1,
-		    MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-	MPI_Reduce( &N_finished_packets, &N_total_packets_finish,1,
-		    MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-        MPI_Reduce( &N_finished_msgs, &N_total_msgs_finish,1,
-                    MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	if(checkpoint_prefix[0])
+	  {
+	    char name[600];
+	    ckpt_header h = ckpt_make_header(checkpoint_time);
 
-	MPI_Reduce( &total_hops, &N_total_hop,1,
-		    MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-	MPI_Reduce( &max_latency, &g_max_latency,1,
-		    MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	    if(checkpoint_time <= restart_time || checkpoint_time > g_tw_ts_end)
+	       tw_error(TW_LOC, "\n Checkpoint time %lf is not after the start %lf and at most the end %lf ", checkpoint_time, restart_time, g_tw_ts_end);
 
-	for( i=1; i<N_COLLECT_POINTS; i++ )
-	  {
-	    total_finished_storage[i]+=total_finished_storage[i-1];
-	    total_generated_storage[i]+=total_generated_storage[i-1];
+	    ckpt_file_name(name, checkpoint_prefix);
+	    if(!(ckpt_file = fopen(name, "wb")))
+	       tw_error(TW_LOC, "\n Cannot create checkpoint %s ", name);
+	    fwrite(&h, sizeof(h), 1, ckpt_file);
 	  }
 
-//	if( total_lp_time > 0 )
-//	   total_lp_time /= num_mpi_msgs;
+	tw_run();
+
+	tw_stime g_max_latency;
+	torus_stats_point * series = torus_stats_reduce(&g_max_latency);
 
 	if(tw_ismaster())
 	  {
+	    torus_stats_point total;
+	    unsigned long long total_finished_storage[N_COLLECT_POINTS];
+	    unsigned long long total_generated_storage[N_COLLECT_POINTS];
+
+	    memset(&total, 0, sizeof(total));
+	    for( i=0; i<N_COLLECT_POINTS; i++ )
+	      {
+		int j;
+		total.generated += series[i].generated;
+		total.finished += series[i].finished;
+		total.hops += series[i].hops;
+		total.latency_sum += series[i].latency_sum;
+		for( j=0; j<STATS_LATENCY_BINS; j++ )
+		   total.latency_hist[j] += series[i].latency_hist[j];
+
+		total_generated_storage[i] = total.generated;
+		total_finished_storage[i] = total.finished;
+	      }
+
 	    printf("\n ****************** \n");
 	    printf("\n total packets finished:         %lld and %lld; \n",
-		   total_finished_storage[N_COLLECT_POINTS-1],N_total_packets_finish);
+		   total_finished_storage[N_COLLECT_POINTS-1], (unsigned long long)total.finished);
 	    printf("\n total MPI messages finished:         %lld; \n",
-                   N_total_msgs_finish);
+                   (unsigned long long)total.finished);
 	    printf("\n total generate:       %lld; \n",
 		   total_generated_storage[N_COLLECT_POINTS-1]);
 	    printf("\n total hops:           %lf; \n",
-		   (double)N_total_hop/N_total_packets_finish);
-	    printf("\n average travel time:  %lf; \n\n",
-		   total_time_sum/N_total_msgs_finish);
+		   total.hops/total.finished);
+	    printf("\n average travel time:  %lf; \n",
+		   total.latency_sum/total.finished);
+	    printf("\n latency percentiles: ");
+	    torus_stats_print_percentile("50th", &total, 0.50);
+	    torus_stats_print_percentile("90th", &total, 0.90);
+	    torus_stats_print_percentile("99th", &total, 0.99);
+	    printf("; \n\n");
 #if REPORT_BANDWIDTH
 	    for( i=0; i<N_COLLECT_POINTS; i++ )
 	      {
@@ -1215,11 +2106,11 @@ main(int argc, char **argv, char **env)
 	interval = interval/(1000.0 * 1000.0 * 1000.0); //convert ns to seconds
         for( i=1; i<N_COLLECT_POINTS; i++ )
            {
-                bandwidth = total_finished_storage[i] - total_finished_storage[i - 1];
-		unsigned long long avg_hops = total_num_hops[i]/bandwidth;
+                bandwidth = series[i].finished;
+		unsigned long long avg_hops = series[i].hops/bandwidth;
                 bandwidth = (bandwidth * PACKET_SIZE) / (1024.0 * 1024.0 * 1024.0); // convert bytes to GB
                 bandwidth = bandwidth / interval;
-                printf("\n Interval %0.7lf Bandwidth %lf avg hops %lld queue depth %lld ", interval, bandwidth, avg_hops, (unsigned long long)total_queue_depth[i]/num_chunks);
+                printf("\n Interval %0.7lf Bandwidth %lf avg hops %lld queue depth %lld ", interval, bandwidth, avg_hops, (unsigned long long)series[i].queue_depth/num_chunks);
            }
 
 	    unsigned long long steady_sum=0;
@@ -1229,9 +2120,16 @@ main(int argc, char **argv, char **env)
 		   2*steady_sum/N_COLLECT_POINTS);
 #endif
 	    printf("\nMax latency is %lf\n\n",g_max_latency);
+
+	    if(stats_file[0])
+	       torus_stats_write(stats_file, stats_binary, series, PACKET_SIZE);
 	}
+	torus_trace_close();
 //	  if(packet_sent > 0 || credit_sent > 0)
 //	    printf("\n Packet sent are %d, credit sent %d ", packet_sent, credit_sent);
 	tw_end();
+
+	if(ckpt_file)
+	   fclose(ckpt_file);
 	return 0;
 }
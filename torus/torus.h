@@ -3,6 +3,8 @@
 
 #include <ross.h>
 #include <assert.h>
+#include "torus-stats.h"
+#include "torus-trace.h"
 
 /* unit time of delay is nano second
  assume 374MB/s bandwidth for BG/P, it takes 64 ns to transfer 32Byte
@@ -10,23 +12,23 @@
  to the user */
 #define REPORT_BANDWIDTH 0
 #define MEAN_PROCESS 1.0
-#define N_dims 5
-#define N_dims_sim 5
 
 // Total available tokens on a VC = VC buffer size / token size
 #define PACKET_SIZE 512
 #define NUM_VC 1
-/*  static int       dim_length[] = {8,4,4,4,4,4,2}; // 7-D torus */
-    static int dim_length_sim[] = {4,4,4,4,2};//512 node case
-    static int dim_length[] = {4,4,4,4,2};
-//    static int dim_length[] = {4, 4, 2, 2, 2, 2, 2}; /* same as original dimension length */
-/*  static int dim_length[] = {16, 8, 8, 8, 2};
-    static int dim_length[] = {10, 10, 10, 8, 4, 4, 2}; // 256K 7D
-    static int dim_length[] = {20, 20, 16, 10, 4}; // 256K 5D
-    static int dim_length[] = {16, 16, 16, 10, 4, 4, 2}; //1.3 million 7D 
-    static int dim_length[] = {10, 8, 8, 8, 4, 4, 4, 2, 2}; // 1.3 million 9D      
-    static int dim_length[] = {10, 8, 8, 8, 4, 4, 4, 2, 2}; // 1.3 million 9D      
-    static int dim_length_sim[] = {32, 32, 32, 20, 2}; //1.3 million 5D */
+
+/* The torus shape is given at run time with --dims (and --dims_sim for the simulated
+ * torus used by the traffic patterns, same as --dims if not given), e.g.
+ *   --dims=4,4,4,4,2                  512 node case (default)
+ *   --dims=8,4,4,4,4,4,2              7-D torus
+ *   --dims=16,8,8,8,2
+ *   --dims=10,10,10,8,4,4,2           256K 7D
+ *   --dims=20,20,16,10,4              256K 5D
+ *   --dims=16,16,16,10,4,4,2          1.3 million 7D
+ *   --dims=10,8,8,8,4,4,4,2,2         1.3 million 9D
+ *   --dims_sim=32,32,32,20,2          1.3 million 5D
+ * Coordinates are kept in bytes so a dimension can be at most 255 long. */
+#define MAX_DIMS 16
 
 /* For reporting statistics, one can configure the number of sample points during
  * which the stats will be reported in the simulation */
@@ -36,14 +38,20 @@
 
 /* For packets waiting to be injected in the network when the buffers are already full. 
  * We probably need to come up with a better strategy here like slow down the injection
- * rate when the buffers are already full instead of making the packets wait in the queue. */
-#define WAITING_PACK_COUNT 1 << 15
+ * rate when the buffers are already full instead of making the packets wait in the queue.
+ * Waiting packets are carved out of a per-PE slab that grows WAITING_SLAB_SIZE records
+ * at a time, so memory follows the actual congestion instead of the worst case. */
+#define WAITING_SLAB_SIZE 1024
 
 typedef enum nodes_event_t nodes_event_t;
 typedef struct nodes_state nodes_state;
 typedef struct mpi_process mpi_process;
 typedef struct nodes_message nodes_message;
 typedef struct waiting_packet waiting_packet;
+typedef struct torus_port torus_port;
+typedef struct torus_ckpt torus_ckpt;
+typedef struct ckpt_event ckpt_event;
+typedef struct ckpt_header ckpt_header;
 
 // Total number of nodes in torus, calculate in main
 static int N_nodes = 1;
@@ -58,7 +66,8 @@ enum nodes_event_t
   CREDIT,
   WAIT,
   MPI_SEND,
-  MPI_RECV
+  MPI_RECV,
+  CHECKPOINT
 };
 
 enum traffic
@@ -68,6 +77,23 @@ enum traffic
   DIAGONAL
 };
 
+/* Checkpoint of one LP (--checkpoint). The first event of the LP at or after the checkpoint time,
+ * at the latest its CHECKPOINT event, serializes the LP state into a pointer-free image before it
+ * is handled. Events the LP sends before that which arrive at or after the checkpoint time are in
+ * flight: they are copied when sent, kept in sent until the event that sent them commits and in
+ * in_flight from then on. Once the event that took the image commits, the image and in_flight
+ * are written to the checkpoint file of the rank and freed. */
+struct torus_ckpt
+{
+  int taken;
+  long image_size;
+  char * image;
+  struct ckpt_event * in_flight;
+  /* copies sent by events that have not committed yet, oldest first */
+  struct ckpt_event * sent_head;
+  struct ckpt_event * sent_tail;
+};
+
 struct mpi_process
 {
  unsigned long long message_counter;
@@ -76,119 +102,191 @@ struct mpi_process
  /*For matrix transpose traffic, we have a row and col value for each MPI process so that the message can be sent to the corresponding transpose of 
  the MPI process */
  int row, col;
+
+ /* next send of the trace replayed by this process (--trace) */
+ long trace_cursor;
+
+ torus_ckpt ckpt;
 };
 
-struct nodes_state
+/* State of one outgoing port (a dimension and direction) of a torus node */
+struct torus_port
 {
-  unsigned long long packet_counter;            
   /* Time when the VC will be available for sending packets on this node */
-  tw_stime next_link_available_time[2*N_dims][NUM_VC]; 
+  tw_stime next_link_available_time[NUM_VC];
   /* Time when the next VC will be available for sending credits on this node*/
-  tw_stime next_credit_available_time[2*N_dims][NUM_VC];
+  tw_stime next_credit_available_time[NUM_VC];
   /* Buffer occupancy of the current VC */
-  int buffer[2*N_dims][NUM_VC]; 
-  /* torus dimension coordinates of this node */
-  int dim_position[N_dims];
+  int buffer[NUM_VC];
+  /* FIFO of packets waiting for buffer space on this port */
+  int wait_count;
+  struct waiting_packet * wait_head;
+  struct waiting_packet * wait_tail;
+};
+
+struct nodes_state
+{
+  unsigned long long packet_counter;            
+  /* torus dimension coordinates of this node, points into the per-PE coordinate table */
+  const unsigned char * dim_position;
   /* torus dimension coordinates of the simulated torus dimension by this node (For TOPC paper)*/
-  int dim_position_sim[N_dims_sim];
-  /* torus neighbor coordinates for this node */ 
-  int neighbour_minus_lpID[N_dims];
-  /* torus plus neighbor coordinates for this node */
-  int neighbour_plus_lpID[N_dims];
+  const unsigned char * dim_position_sim;
+  /* minus and plus torus neighbors of this node indexed by port (dir + dim * 2),
+   * points into the per-PE neighbor table */
+  tw_lpid * neighbour;
   
   // For simulation purposes: Making the same nearest neighbor traffic
   // across all torus dimensions
   /* neighbors of the simulated torus dimension for this node */
-  int neighbour_minus_lpID_sim[N_dims_sim];
-  int neighbour_plus_lpID_sim[N_dims_sim];   
+  tw_lpid * neighbour_sim;
 
   int source_dim;
   int direction;
 
-  //first element of linked list
-  struct waiting_packet * waiting_list;
-  struct waiting_packet * head;
-  long wait_count;
+  torus_ckpt ckpt;
+
+  /* MPI process of this node, only used when it runs inside the node LP (--combined=1) */
+  mpi_process mpi;
+
+  /* 2 * N_dims ports indexed by dir + dim * 2, the LP state size is set at run time to fit them */
+  torus_port port[];
 };
 
+/* Torus event: a small header common to every event, the packet payload used by GENERATE, SEND,
+ * WAIT, ARRIVAL and MPI_RECV events and the state saved for reverse computation. The destination
+ * coordinates are never carried, they come from the per-PE coordinate table through dest_lp.
+ * lpIDs are kept in 32 bits, -1 marks an unset next stop or sender. */
 struct nodes_message
 {
-  /* time when the flit/packet starts travelling */
-  tw_stime travel_start_time;
-  /* saved time for reverse computation */
-  tw_stime saved_available_time;
-
-  /* packet ID of the flit */
-  unsigned long long packet_ID;
-  /* event time: mpi_send, mpi_recv, packet_generate etc. */
-  nodes_event_t	 type;
+  /* event type: mpi_send, mpi_recv, packet_generate etc. */
+  unsigned char type;
 
   /* originating torus node dimension and direction */
-  int source_dim;
-  int source_direction;
-  
-  /* originating torus node dimension and direction (for reverse computation) */
-  int saved_src_dim;
-  int saved_src_dir;
+  unsigned char source_dim;
+  unsigned char source_direction;
 
   /* For waiting messages/packets/flits that don't get a slot in the buffer*/
-  int wait_dir;
-  int wait_dim;
+  unsigned char wait_dir;
+  unsigned char wait_dim;
+  /* for packets waiting to be injected into the network */
+  signed char wait_type;
 
-  /* destination torus coordinates for this packet/message/flit */
-  int dest[N_dims];
+  /* flit/chunk ID of the packet, a packet has at most 256 chunks */
+  unsigned char chunk_id;
+  /* the LP took its checkpoint just before handling this event */
+  unsigned char ckpt_taken;
 
+  /* packet payload */
+  /* time when the flit/packet starts travelling */
+  tw_stime travel_start_time;
+  /* packet ID of the flit */
+  unsigned long long packet_ID;
   /* destination LP ID for this packet/message/flit */
-  tw_lpid dest_lp;
+  unsigned int dest_lp;
   /* sender LP ID for this packet/message/flit */
-  tw_lpid sender_lp;
-
+  unsigned int sender_lp;
+  /* next stop of this message/packet/flit */
+  unsigned int next_stop;
   /* number of hops travelled by this message */
   int my_N_hop;
-  
-  /* next stop of this message/packet/flit */
-  tw_lpid next_stop;
-  /* size of the message/packet/flit in bytes */
-  int packet_size;
-  /* flit/chunk ID of the packet */
-  short chunk_id;
-  /* for packets waiting to be injected into the network */
-  int wait_loc;
-  int wait_type;
+
+  /* saved time for reverse computation */
+  tw_stime saved_available_time;
+  union
+  {
+    /* waiting packet released by a credit, kept until commit for reverse computation (CREDIT) */
+    struct waiting_packet * wait_rec;
+    /* trace record replayed by this event (MPI_SEND with --trace) */
+    long trace_record;
+    struct
+    {
+      /* time of a generated or delivered packet and the buffer occupancy of the node that
+       * delivered it, recorded in the statistics when the event commits (SEND, ARRIVAL, MPI_RECV) */
+      tw_stime stat_time;
+      unsigned int stat_queue_depth;
+      /* originating torus node dimension and direction (SEND) */
+      unsigned char saved_src_dim;
+      unsigned char saved_src_dir;
+    };
+  };
+};
+
+/* event in flight at the checkpoint with its destination and receive time, cause is the event
+ * that sent it as long as that one can still be rolled back */
+struct ckpt_event
+{
+  tw_lpid dest;
+  tw_stime recv_time;
+  nodes_message msg;
+  const nodes_message * cause;
+  struct ckpt_event * prev;
+  struct ckpt_event * next;
 };
 
-/* Linked list for storing waiting packets in the queue */
+/* Header of the checkpoint file of a rank, followed by one record per LP: lpID, image size,
+ * image, number of events in flight sent by the LP and those events (destination lpID, receive
+ * time, message). A restart has to use the same torus, mapping and number of ranks. */
+#define CKPT_MAGIC 0x54504b43
+#define CKPT_VERSION 2
+
+struct ckpt_header
+{
+  unsigned int magic;
+  unsigned int version;
+  int n_ranks;
+  int N_dims;
+  int dim_length[MAX_DIMS];
+  int wormhole;
+  int combined;
+  int block_mapping;
+  int message_size;
+  tw_stime time;
+};
+
+/* Waiting packet record, holds its own copy of the packet so that it never
+ * points into event memory */
 struct waiting_packet
 {
-   int dim;
-   int dir;
-   nodes_message * packet;
+   nodes_message packet;
    struct waiting_packet * next;
+   struct waiting_packet * prev;
 };
 
-/* overall simulation statistics, average travel time, total time and maximum packet
- * latency per PE */
-tw_stime         average_travel_time = 0;
-tw_stime         total_time = 0;
-tw_stime         max_latency = 0;
-
-/* number of finished packets and messages per PE */
-static unsigned long long       N_finished_packets = 0;
-static unsigned long long N_finished_msgs = 0;
-
-/* number of finished packets, generated packets, size of buffer queues
- * and average number of hops travelled by the packets at different 
- * points during the simulation per PE */
-static unsigned long long       N_finished_storage[N_COLLECT_POINTS];
-static unsigned long long       N_generated_storage[N_COLLECT_POINTS];
-static unsigned long long 	N_queue_depth[N_COLLECT_POINTS];
-static unsigned long long	N_num_hops[N_COLLECT_POINTS];
-static unsigned long long       total_hops = 0;
+/* per-PE slab of free waiting packet records */
+static struct waiting_packet * waiting_free_list = NULL;
+static long waiting_slab_records = 0;
+
+/* torus shape, set from --dims and --dims_sim */
+static int N_dims;
+static int N_dims_sim;
+static int dim_length[MAX_DIMS];
+static int dim_length_sim[MAX_DIMS];
+static char dims_str[512] = "4,4,4,4,2";
+static char dims_sim_str[512] = "";
 
 /* for calculating torus dimensions of real and simulated torus coordinates of
  * a node*/
-static int       half_length[N_dims];
-static int	 half_length_sim[N_dims_sim];
+static int       half_length[MAX_DIMS];
+static int	 half_length_sim[MAX_DIMS];
+
+/* per-PE lookup tables: coordinates of every torus node and neighbors of the
+ * node LPs mapped on this PE (indexed by local LP ID) */
+static unsigned char * coord_table;
+static unsigned char * coord_table_sim;
+static tw_lpid * neighbour_table;
+static tw_lpid * neighbour_table_sim;
+
+#define torus_coords(lpid) (&coord_table[(lpid) * N_dims])
+#define torus_coords_sim(lpid) (&coord_table_sim[(lpid) * N_dims_sim])
+
+/* block mapping: every rank owns a block of block_length[] nodes, block_count[] blocks
+ * along each dimension, and the block of a rank is cut into kp_count[] sub-blocks, one per KP */
+static int block_mapping = 0;
+static int block_length[MAX_DIMS];
+static int block_count[MAX_DIMS];
+static int kp_count[MAX_DIMS];
+static int kp_blocks = 0;
+static char mapping_str[32] = "linear";
 
 /* ROSS simulation statistics */
 static int	 nlp_nodes_per_pe;
@@ -205,14 +303,43 @@ static int TRAFFIC = UNIFORM_RANDOM;
 static int injection_limit = 10;
 static double injection_interval = 20000;
 static int vc_size = 16384;
+static int max_waiting = 1 << 15;
+static int wormhole = 0;
+static int combined_lp = 0;
 static double link_bandwidth = 2.0;
 static char traffic_str[512] = "uniform";
+/* time series of the statistics, written only if a file is given */
+static char stats_file[512] = "";
+static int stats_binary = 0;
+static double latency_bin = 100.0;
+/* MPI trace replayed instead of the synthetic traffic if given */
+static char trace_file[512] = "";
+/* checkpoint written at checkpoint_time to <checkpoint>.<rank>, restart from <restart>.<rank> */
+static char checkpoint_prefix[512] = "";
+static double checkpoint_time = 0;
+static char restart_prefix[512] = "";
+static double restart_time = 0;
+static FILE * ckpt_file = NULL;
+/* checkpoint of the LP being initialized or handling an event and that event (NULL in the init
+ * handlers), the events in flight sent meanwhile belong to them */
+static torus_ckpt * ckpt_current = NULL;
+static nodes_message * ckpt_cause = NULL;
+/* destination and receive time of the event created last by torus_event_new */
+static tw_lpid ckpt_send_dest;
+static tw_stime ckpt_send_time;
+static char * ckpt_data = NULL;
+static long ckpt_data_size = 0;
+static const char ** ckpt_records = NULL;
 
 /* number of packets in a message and number of chunks/flits in a packet */
 int num_packets;
 int num_chunks;
 int packet_offset = 0;
 const int chunk_size = 32;
+/* chunks moved by one SEND/ARRIVAL event and events needed per packet,
+ * 1 and num_chunks unless running in wormhole mode */
+int chunks_per_event = 1;
+int sends_per_packet;
 int num_buf_slots;
 
 /* for ROSS mapping purposes */
@@ -220,12 +347,13 @@ int node_rem = 0;
 
 int num_rows, num_cols;
 /* for calculating torus dimensions */
-int factor[N_dims];
-int factor_sim[N_dims_sim];
+int factor[MAX_DIMS];
+int factor_sim[MAX_DIMS];
 
 /* calculating delays using the link bandwidth */
 float head_delay=0.0;
 float credit_delay = 0.0;
+float serialization_delay = 0.0;
 
 // debug
 int credit_sent = 0;
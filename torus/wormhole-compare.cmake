@@ -0,0 +1,35 @@
+# Runs the torus model in chunk and in wormhole mode with the same options and compares the
+# average hop count and latency. Fails when the hop counts differ by more than 1%, the latency
+# gap is only printed. Run as
+#   cmake -DTORUS=./torus "-DARGS=--synch=1 --end=20000 --traffic=uniform" -P wormhole-compare.cmake
+
+separate_arguments(ARGS)
+
+foreach(mode 0 1)
+  execute_process(COMMAND ${TORUS} ${ARGS} --wormhole=${mode}
+		  OUTPUT_VARIABLE out RESULT_VARIABLE status)
+  if(NOT status EQUAL 0)
+    message(FATAL_ERROR "torus --wormhole=${mode} failed: ${status}")
+  endif()
+  string(REGEX MATCH "total hops: *([0-9.]+)" match "${out}")
+  set(hops_${mode} ${CMAKE_MATCH_1})
+  string(REGEX MATCH "average travel time: *([0-9.]+)" match "${out}")
+  set(latency_${mode} ${CMAKE_MATCH_1})
+  if(NOT hops_${mode} OR NOT latency_${mode})
+    message(FATAL_ERROR "no hop count or latency in the output of --wormhole=${mode}")
+  endif()
+endforeach()
+
+execute_process(COMMAND awk "BEGIN { printf \"%.2f %.2f\", 100 * (${hops_1} - ${hops_0}) / ${hops_0}, 100 * (${latency_1} - ${latency_0}) / ${latency_0} }"
+		OUTPUT_VARIABLE gaps)
+separate_arguments(gaps)
+list(GET gaps 0 hops_gap)
+list(GET gaps 1 latency_gap)
+
+message("chunk    hops ${hops_0} latency ${latency_0}")
+message("wormhole hops ${hops_1} latency ${latency_1}")
+message("wormhole vs chunk: hops ${hops_gap}%, latency ${latency_gap}%")
+
+if(hops_gap GREATER 1 OR hops_gap LESS -1)
+  message(FATAL_ERROR "hop counts differ by more than 1%")
+endif()